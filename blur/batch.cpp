@@ -0,0 +1,192 @@
+/*
+Author: David Holmqvist <daae19@student.bth.se>
+*/
+
+#include "batch.hpp"
+#include "matrix.hpp"
+#include "parallel.hpp"
+#include "ppm.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+namespace Batch {
+
+namespace {
+
+    // One image travelling through the pipeline. Frames are recycled, so
+    // their matrices keep their planes from one image to the next.
+    struct Frame {
+        std::size_t index;
+        Matrix input;
+        Matrix output;
+        bool ok;
+    };
+
+    // One frame per stage plus one, so the loader can run a frame ahead of
+    // a busy blur stage.
+    constexpr unsigned frames_in_flight { 4 };
+
+    // Runs load -> blur -> store over `count` recycled frames, with a
+    // loader thread, a blur thread and the calling thread storing. load
+    // fills in a frame and returns false once there are no more; frames it
+    // marks as not ok skip the blur and count as failed. Returns the number
+    // of failed frames.
+    template <typename Load, typename Store>
+    unsigned pipeline(unsigned count, Load load, Store store, int radius, Filter::Engine engine, unsigned threads)
+    {
+        std::vector<Frame> frames(count);
+        Parallel::Queue<Frame*> free { count }, loaded { count }, blurred { count };
+
+        for (auto& frame : frames) {
+            free.push(&frame);
+        }
+
+        // A null frame marks the end of the stream for the next stage.
+        std::thread loader { [&] {
+            while (true) {
+                auto frame { free.pop() };
+
+                if (!load(*frame)) {
+                    break;
+                }
+
+                loaded.push(frame);
+            }
+
+            loaded.push(nullptr);
+        } };
+
+        std::thread blurrer { [&] {
+            Filter::Workspace workspace {};
+
+            while (auto frame { loaded.pop() }) {
+                if (frame->ok && threads > 1) {
+                    Filter::blur_par(frame->input, frame->output, radius, threads, engine, workspace);
+                } else if (frame->ok) {
+                    Filter::blur(frame->input, frame->output, radius, engine, workspace);
+                }
+
+                blurred.push(frame);
+            }
+
+            blurred.push(nullptr);
+        } };
+
+        auto failed { 0u };
+
+        while (auto frame { blurred.pop() }) {
+            if (!frame->ok || !store(*frame)) {
+                failed++;
+            }
+
+            free.push(frame);
+        }
+
+        loader.join();
+        blurrer.join();
+
+        return failed;
+    }
+
+}
+
+std::optional<std::vector<Job>> jobs(std::string source, std::string output_directory)
+{
+    namespace fs = std::filesystem;
+
+    std::vector<Job> result {};
+    std::error_code error {};
+
+    auto output_for { [&](const fs::path& input) {
+        return (fs::path { output_directory } / input.filename()).string();
+    } };
+
+    if (fs::is_directory(source, error)) {
+        for (auto& entry : fs::directory_iterator { source, error }) {
+            if (entry.is_regular_file() && entry.path().extension() == ".ppm") {
+                result.push_back({ entry.path().string(), output_for(entry.path()) });
+            }
+        }
+
+        if (error) {
+            std::cerr << "Failed to list " << source << ": " << error.message() << std::endl;
+            return std::nullopt;
+        }
+
+        std::sort(result.begin(), result.end(), [](const Job& a, const Job& b) { return a.input < b.input; });
+        return result;
+    }
+
+    std::ifstream f {};
+    f.open(source);
+
+    if (!f) {
+        std::cerr << "Failed to read manifest " << source << std::endl;
+        return std::nullopt;
+    }
+
+    std::string line {};
+
+    while (std::getline(f, line)) {
+        std::stringstream ss { line };
+        std::string input {}, output {};
+
+        if (!(ss >> input) || input[0] == '#') {
+            continue;
+        }
+
+        if (!(ss >> output)) {
+            output = output_for(input);
+        }
+
+        result.push_back({ input, output });
+    }
+
+    return result;
+}
+
+unsigned run(const std::vector<Job>& jobs, int radius, Filter::Engine engine, unsigned threads)
+{
+    PPM::Reader reader {};
+    PPM::Writer writer {};
+    std::size_t next { 0 };
+
+    return pipeline(
+        frames_in_flight,
+        [&](Frame& frame) {
+            if (next == jobs.size()) {
+                return false;
+            }
+
+            frame.index = next++;
+            frame.ok = reader(jobs[frame.index].input, frame.input);
+            return true;
+        },
+        [&](const Frame& frame) { return writer(frame.output, jobs[frame.index].output); },
+        radius, engine, threads);
+}
+
+unsigned run_stream(int input, int output, int radius, Filter::Engine engine, unsigned threads)
+{
+    PPM::FrameReader reader { input };
+    PPM::FrameWriter writer { output };
+
+    // Frame N + 1 is parsed while N is blurred and N - 1 written; with one
+    // frame per stage nothing queues up behind them.
+    auto failed { pipeline(
+        3,
+        [&](Frame& frame) {
+            frame.ok = true;
+            return reader(frame.input);
+        },
+        [&](const Frame& frame) { return writer(frame.output); },
+        radius, engine, threads) };
+
+    return failed + (reader.failed() ? 1 : 0);
+}
+
+}
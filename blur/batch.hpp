@@ -0,0 +1,42 @@
+/*
+Author: David Holmqvist <daae19@student.bth.se>
+*/
+
+#include "filters.hpp"
+#include <optional>
+#include <string>
+#include <vector>
+
+#if !defined(BATCH_HPP)
+#define BATCH_HPP
+
+namespace Batch {
+
+struct Job {
+    std::string input;
+    std::string output;
+};
+
+// The jobs for `source`: every .ppm file in it if it is a directory,
+// otherwise one job per line of the manifest it names, written as
+// "infile [outfile]". Blank lines and lines starting with '#' are skipped.
+// Inputs without an explicit outfile are written to output_directory under
+// their own file name. Reports and returns nothing on failure.
+std::optional<std::vector<Job>> jobs(std::string source, std::string output_directory);
+
+// Blurs every job through a three-stage pipeline: a loader thread reads
+// frames, a blur thread (fanning out to `threads` workers) blurs them and
+// the calling thread writes them, with bounded queues in between. A fixed
+// set of frames circulates through the stages, so after the first few
+// images nothing is allocated. Returns the number of jobs that failed.
+unsigned run(const std::vector<Job>& jobs, int radius, Filter::Engine engine, unsigned threads);
+
+// The same pipeline over a stream of concatenated P6 frames read from the
+// `input` descriptor, writing the blurred frames back to back to `output`.
+// Returns the number of frames that failed, counting a malformed or
+// truncated input stream as one.
+unsigned run_stream(int input, int output, int radius, Filter::Engine engine, unsigned threads);
+
+}
+
+#endif
@@ -0,0 +1,359 @@
+/*
+Author: David Holmqvist <daae19@student.bth.se>
+*/
+
+#include "matrix.hpp"
+#include "ppm.hpp"
+#include "filters.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+// Times the PPM decoder, every requested engine and the PPM encoder over a
+// sweep of synthetic images, radii and thread counts, and prints one record
+// per combination with the spread of the timed repetitions, the throughput
+// and the speedup over the fewest threads swept. Images are generated from a
+// fixed seed, so two runs on the same machine measure the same work and
+// their reports can be compared to catch regressions.
+
+namespace {
+
+struct Size {
+    unsigned x;
+    unsigned y;
+};
+
+struct Options {
+    std::vector<Size> sizes { { 512, 512 }, { 1024, 1024 }, { 2048, 2048 } };
+    std::vector<int> radii { 3, 15, 40 };
+    std::vector<unsigned> threads { 1, 2, 4 };
+    std::vector<std::pair<std::string, Filter::Engine>> engines { { "exact", Filter::Engine::exact } };
+    unsigned warmup { 1 };
+    unsigned repeat { 5 };
+    bool json { false };
+    std::optional<std::string> generate {};
+};
+
+// Seconds of the timed repetitions of one stage of one combination.
+struct Record {
+    std::string stage;
+    std::string engine;
+    Size size;
+    int radius;
+    unsigned threads;
+    std::vector<double> seconds;
+};
+
+void usage(char const* program)
+{
+    std::cerr << "Usage: " << program << " [options]" << std::endl
+              << "       " << program << " --generate=DIR [--sizes=...]" << std::endl
+              << "  --sizes=SIZE,...        image sizes, N or WxH, at most " << PPM::max_dimension << " a side" << std::endl
+              << "                          (512,1024,2048)" << std::endl
+              << "  --radii=R,...           blur radii (3,15,40)" << std::endl
+              << "  --threads=N,...         thread counts (1,2,4)" << std::endl
+              << "  --engines=NAME,...      engines, as for blur --engine (exact)" << std::endl
+              << "  --warmup=N              untimed runs before each measurement (1)" << std::endl
+              << "  --repeat=N              timed runs per measurement (5)" << std::endl
+              << "  --format=csv|json       report format (csv)" << std::endl
+              << "  --generate=DIR          only write the synthetic images to DIR" << std::endl;
+    std::exit(1);
+}
+
+std::vector<std::string> split(const std::string& list)
+{
+    std::vector<std::string> items {};
+    std::istringstream stream { list };
+
+    for (std::string item; std::getline(stream, item, ',');) {
+        items.push_back(item);
+    }
+
+    return items;
+}
+
+// A positive number no larger than `max`, or nothing.
+std::optional<unsigned> number(const std::string& text, unsigned max)
+{
+    char* end {};
+    auto value { std::strtoul(text.c_str(), &end, 10) };
+
+    if (text.empty() || *end != '\0' || value == 0 || value > max) {
+        return std::nullopt;
+    }
+
+    return static_cast<unsigned>(value);
+}
+
+std::optional<Size> parse_size(const std::string& text)
+{
+    auto x { text.find('x') };
+    auto width { number(text.substr(0, x), PPM::max_dimension) };
+    auto height { x == std::string::npos ? width : number(text.substr(x + 1), PPM::max_dimension) };
+
+    if (!width || !height) {
+        return std::nullopt;
+    }
+
+    return Size { *width, *height };
+}
+
+Options parse(int argc, char const* argv[])
+{
+    Options options {};
+
+    for (auto arg { 1 }; arg < argc; arg++) {
+        std::string option { argv[arg] };
+        auto equals { option.find('=') };
+        auto name { option.substr(0, equals) };
+        auto value { equals == std::string::npos ? std::string {} : option.substr(equals + 1) };
+        auto ok { !value.empty() };
+
+        if (name == "--sizes") {
+            options.sizes.clear();
+            for (auto& item : split(value)) {
+                auto size { parse_size(item) };
+                ok = ok && size;
+                options.sizes.push_back(size.value_or(Size {}));
+            }
+        } else if (name == "--radii") {
+            options.radii.clear();
+            for (auto& item : split(value)) {
+                auto radius { number(item, Filter::Gauss::max_radius) };
+                ok = ok && radius;
+                options.radii.push_back(radius.value_or(0));
+            }
+        } else if (name == "--threads") {
+            options.threads.clear();
+            for (auto& item : split(value)) {
+                auto threads { number(item, 1024) };
+                ok = ok && threads;
+                options.threads.push_back(threads.value_or(0));
+            }
+        } else if (name == "--engines") {
+            options.engines.clear();
+            for (auto& item : split(value)) {
+                auto engine { Filter::engine_from_name(item) };
+                ok = ok && engine;
+                options.engines.emplace_back(item, engine.value_or(Filter::Engine::exact));
+            }
+        } else if (name == "--warmup") {
+            auto warmup { value == "0" ? std::optional<unsigned> { 0 } : number(value, 1000) };
+            ok = ok && warmup;
+            options.warmup = warmup.value_or(0);
+        } else if (name == "--repeat") {
+            auto repeat { number(value, 1000) };
+            ok = ok && repeat;
+            options.repeat = repeat.value_or(0);
+        } else if (name == "--format") {
+            ok = value == "csv" || value == "json";
+            options.json = value == "json";
+        } else if (name == "--generate") {
+            options.generate = value;
+        } else {
+            ok = false;
+        }
+
+        if (!ok) {
+            std::cerr << "Invalid option: " << option << std::endl;
+            usage(argv[0]);
+        }
+    }
+
+    std::sort(options.threads.begin(), options.threads.end());
+
+    return options;
+}
+
+// Smooth gradients, a ring pattern, hard-edged blocks and noise, different
+// for every channel: a mix of the low and high frequencies photographs have,
+// so no engine gets to skip work on flat regions.
+Matrix synthesize(Size size)
+{
+    Matrix m { size.x, size.y };
+    m.set_color_max(255);
+
+    std::mt19937 random { 1674 };
+    std::uniform_int_distribution<int> noise { -24, 24 };
+    unsigned char* planes[3] { m.get_R(), m.get_G(), m.get_B() };
+    auto cx { size.x / 2.0 }, cy { size.y / 2.0 };
+
+    for (auto c { 0 }; c < 3; c++) {
+        for (auto y { 0u }; y < size.y; y++) {
+            for (auto x { 0u }; x < size.x; x++) {
+                auto gradient { 96.0 * (c == 1 ? y : x) / std::max(1u, c == 1 ? size.y : size.x) };
+                auto ring { 48.0 * std::sin(std::hypot(x - cx, y - cy) / (6.0 + 4 * c)) };
+                auto block { ((x / (32 << c)) + (y / 48)) % 2 == 0 ? 64.0 : 0.0 };
+                auto v { 32 + gradient + ring + block + noise(random) };
+
+                planes[c][y * m.get_stride() + x] = static_cast<unsigned char>(std::clamp(v, 0.0, 255.0));
+            }
+        }
+    }
+
+    return m;
+}
+
+std::string file_name(Size size)
+{
+    return "synthetic_" + std::to_string(size.x) + "x" + std::to_string(size.y) + ".ppm";
+}
+
+// `warmup` untimed and then `repeat` timed calls of run.
+std::vector<double> measure(const Options& options, const std::function<void()>& run)
+{
+    for (auto i { 0u }; i < options.warmup; i++) {
+        run();
+    }
+
+    std::vector<double> seconds {};
+
+    for (auto i { 0u }; i < options.repeat; i++) {
+        auto start { std::chrono::steady_clock::now() };
+        run();
+        seconds.push_back(std::chrono::duration<double> { std::chrono::steady_clock::now() - start }.count());
+    }
+
+    return seconds;
+}
+
+struct Statistics {
+    double min;
+    double median;
+    double mean;
+    double stddev;
+};
+
+Statistics statistics(std::vector<double> seconds)
+{
+    std::sort(seconds.begin(), seconds.end());
+
+    auto count { seconds.size() };
+    auto mean { 0.0 }, variance { 0.0 };
+
+    for (auto s : seconds) {
+        mean += s / count;
+    }
+    for (auto s : seconds) {
+        variance += (s - mean) * (s - mean) / std::max<std::size_t>(1, count - 1);
+    }
+
+    auto median { count % 2 == 1 ? seconds[count / 2] : (seconds[count / 2 - 1] + seconds[count / 2]) / 2 };
+
+    return { seconds.front(), median, mean, std::sqrt(variance) };
+}
+
+void report(const std::vector<Record>& records, bool json)
+{
+    std::cout << std::setprecision(6);
+
+    if (json) {
+        std::cout << "[" << std::endl;
+    } else {
+        std::cout << "stage,engine,width,height,radius,threads,runs,min_s,median_s,mean_s,stddev_s,mpixels_per_s,speedup" << std::endl;
+    }
+
+    for (std::size_t i { 0 }; i < records.size(); i++) {
+        auto& record { records[i] };
+        auto stats { statistics(record.seconds) };
+        auto megapixels { static_cast<double>(record.size.x) * record.size.y / 1e6 };
+
+        // The same stage, engine, size and radius at the fewest threads swept.
+        auto baseline { std::find_if(records.begin(), records.end(), [&](const Record& other) {
+            return other.stage == record.stage && other.engine == record.engine && other.size.x == record.size.x
+                && other.size.y == record.size.y && other.radius == record.radius;
+        }) };
+        auto speedup { statistics(baseline->seconds).median / stats.median };
+
+        if (json) {
+            std::cout << "  {\"stage\": \"" << record.stage << "\", \"engine\": \"" << record.engine << "\", "
+                      << "\"width\": " << record.size.x << ", \"height\": " << record.size.y << ", "
+                      << "\"radius\": " << record.radius << ", \"threads\": " << record.threads << ", "
+                      << "\"runs\": " << record.seconds.size() << ", \"min_s\": " << stats.min << ", "
+                      << "\"median_s\": " << stats.median << ", \"mean_s\": " << stats.mean << ", "
+                      << "\"stddev_s\": " << stats.stddev << ", \"mpixels_per_s\": " << megapixels / stats.median << ", "
+                      << "\"speedup\": " << speedup << "}" << (i + 1 < records.size() ? "," : "") << std::endl;
+        } else {
+            std::cout << record.stage << "," << record.engine << "," << record.size.x << "," << record.size.y << ","
+                      << record.radius << "," << record.threads << "," << record.seconds.size() << ","
+                      << stats.min << "," << stats.median << "," << stats.mean << "," << stats.stddev << ","
+                      << megapixels / stats.median << "," << speedup << std::endl;
+        }
+    }
+
+    if (json) {
+        std::cout << "]" << std::endl;
+    }
+}
+
+}
+
+int main(int argc, char const* argv[])
+{
+    auto options { parse(argc, argv) };
+    PPM::Reader reader {};
+    PPM::Writer writer {};
+
+    if (options.generate) {
+        std::filesystem::create_directories(*options.generate);
+
+        for (auto size : options.sizes) {
+            if (!writer(synthesize(size), (std::filesystem::path { *options.generate } / file_name(size)).string())) {
+                return 1;
+            }
+        }
+
+        return 0;
+    }
+
+    // The decoder and encoder are timed on a real file, kept apart from
+    // other runs by the process id.
+    auto directory { std::filesystem::temp_directory_path() / ("bench_blur." + std::to_string(getpid())) };
+    std::filesystem::create_directories(directory);
+
+    std::vector<Record> records {};
+    Filter::Workspace workspace {};
+    Matrix decoded {};
+    Matrix blurred {};
+    auto ok { true };
+
+    for (auto size : options.sizes) {
+        auto m { synthesize(size) };
+        auto input { (directory / file_name(size)).string() };
+        auto output { (directory / ("blurred_" + file_name(size))).string() };
+
+        ok = ok && writer(m, input);
+
+        for (auto threads : options.threads) {
+            records.push_back({ "decode", "-", size, 0, threads, measure(options, [&] { ok = reader(input, decoded, threads) && ok; }) });
+
+            for (auto& [name, engine] : options.engines) {
+                for (auto radius : options.radii) {
+                    records.push_back({ "blur", name, size, radius, threads, measure(options, [&, engine = engine] {
+                                           threads > 1 ? Filter::blur_par(m, blurred, radius, threads, engine, workspace)
+                                                       : Filter::blur(m, blurred, radius, engine, workspace);
+                                       }) });
+                }
+            }
+
+            records.push_back({ "encode", "-", size, 0, threads, measure(options, [&] { ok = writer(m, output, threads) && ok; }) });
+        }
+    }
+
+    std::filesystem::remove_all(directory);
+
+    report(records, options.json);
+
+    return ok ? 0 : 1;
+}
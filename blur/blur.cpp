@@ -4,25 +4,343 @@ Author: David Holmqvist <daae19@student.bth.se>
 
 #include "matrix.hpp"
 #include "ppm.hpp"
+#include "batch.hpp"
 #include "filters.hpp"
+#include "parallel.hpp"
+#include "pipeline.hpp"
+#include "profile.hpp"
+#include "streaming.hpp"
+#include <algorithm>
+#include <cctype>
 #include <cstdlib>
+#include <filesystem>
 #include <iostream>
+#include <optional>
+#include <string>
+#include <unistd.h>
+
+namespace {
+
+void usage(char const* program)
+{
+    std::cerr << "Usage: " << program << " [options] [radius] [infile] [outfile]" << std::endl
+              << "       " << program << " --pipeline=STAGE,... [--threads=N] [infile] [outfile]" << std::endl
+              << "  --engine=NAME           exact (default), tiled, fixed, float, pyramid," << std::endl
+              << "                          iir or box" << std::endl
+              << "  infile may be a P6 or P5 (grey) image with up to 16 bits a sample; grey and" << std::endl
+              << "  16-bit images keep their format and only take the exact engine" << std::endl
+              << "  --streaming             read, blur and write row by row (exact engine only)" << std::endl
+              << "  --batch                 infile is a directory of .ppm files or a manifest of" << std::endl
+              << "                          \"infile [outfile]\" lines, outfile the output directory" << std::endl
+              << "  --frames                blur concatenated frames from stdin to stdout;" << std::endl
+              << "                          infile and outfile may be omitted or given as -" << std::endl
+              << "  --shard=I/N             blur only the I-th of N horizontal strips, reading just" << std::endl
+              << "                          its rows and a radius of halo; join them with blur-stitch" << std::endl
+              << "  --threads=N             blur each image with N threads" << std::endl
+              << "  --affinity=CPUS         pin worker i to the i-th CPU of a list such as" << std::endl
+              << "                          0-7,16-23, wrapping around" << std::endl
+              << "  --validate              also blur with the exact engine and report the" << std::endl
+              << "                          largest and mean difference over all samples and PSNR" << std::endl
+              << "  --pipeline=STAGE,...    run a fused chain of blur:RADIUS, box:RADIUS," << std::endl
+              << "                          unsharp:RADIUS:AMOUNT and sobel stages instead" << std::endl;
+    std::exit(1);
+}
+
+// The positional radius, between 1 and Gauss::max_radius.
+unsigned parse_radius(char const* program, char const* text)
+{
+    auto radius { Filter::parse_radius(text) };
+
+    if (!radius) {
+        std::cerr << "Radius must be between 1 and " << Filter::Gauss::max_radius << ": " << text << std::endl;
+        usage(program);
+    }
+
+    return static_cast<unsigned>(*radius);
+}
+
+// Blurs shard `index` of `count`: band `index` of the rows, read with a
+// halo of radius rows on either side so that they come out exactly as in a
+// blur of the whole image, and written as a PPM of just those rows.
+bool shard(unsigned index, unsigned count, int radius, Filter::Engine engine, unsigned threads, char const* input, char const* output)
+{
+    PPM::StripReader reader {};
+
+    if (!reader.open(input)) {
+        return false;
+    }
+
+    if (count > reader.get_y_size()) {
+        std::cerr << "More shards than rows: " << count << " > " << reader.get_y_size() << std::endl;
+        return false;
+    }
+
+    auto [y_begin, y_end] { Parallel::band(index, count, reader.get_y_size()) };
+    auto top { y_begin - std::min(y_begin, static_cast<unsigned>(radius)) };
+    auto bottom { std::min(y_end + radius, reader.get_y_size()) };
+
+    Matrix strip {}, blurred {};
+    Filter::Workspace workspace {};
+
+    if (!reader(top, bottom, strip)) {
+        return false;
+    }
+
+    if (threads > 1) {
+        Filter::blur_par(strip, blurred, radius, threads, engine, workspace);
+    } else {
+        Filter::blur(strip, blurred, radius, engine, workspace);
+    }
+
+    Matrix result { blurred.get_x_size(), y_end - y_begin };
+    result.set_color_max(blurred.get_color_max());
+
+    unsigned char const* from[3] { blurred.get_R(), blurred.get_G(), blurred.get_B() };
+    unsigned char* to[3] { result.get_R(), result.get_G(), result.get_B() };
+
+    for (auto c { 0 }; c < 3; c++) {
+        for (auto y { y_begin }; y < y_end; y++) {
+            std::copy_n(from[c] + (y - top) * blurred.get_stride(), result.get_x_size(), to[c] + (y - y_begin) * result.get_stride());
+        }
+    }
+
+    return PPM::Writer {}(result, output, threads);
+}
+
+// Blurs a grey or 16-bit image with the exact engine, in its own format.
+template <typename Image>
+bool blur_format(int radius, unsigned threads, char const* input, char const* output)
+{
+    Image m {}, blurred {};
+
+    if (!PPM::Reader {}(input, m, threads)) {
+        return false;
+    }
+
+    {
+        Profile::Scope scope { "blur" };
+        Filter::blur(m, blurred, radius, threads);
+    }
+
+    return PPM::Writer {}(blurred, output, threads);
+}
+
+}
 
 int main(int argc, char const* argv[])
 {
-    if (argc != 4) {
-        std::cerr << "Usage: " << argv[0] << " [radius] [infile] [outfile]" << std::endl;
-        std::exit(1);
+    // Builds with make PROFILE=1 report their phases as JSON on stderr.
+    std::atexit([] { Profile::report(std::cerr); });
+
+    auto engine { Filter::Engine::exact };
+    auto streaming { false };
+    auto batch { false };
+    auto frames { false };
+    auto validate { false };
+    std::optional<Filter::Pipeline> pipeline {};
+    std::optional<std::pair<unsigned, unsigned>> sharding {};
+    auto threads { 1u };
+    auto arg { 1 };
+
+    for (; arg < argc && std::string { argv[arg] }.rfind("--", 0) == 0; arg++) {
+        std::string option { argv[arg] };
+
+        if (option.rfind("--engine=", 0) == 0) {
+            auto name { option.substr(std::string { "--engine=" }.size()) };
+            auto selected { Filter::engine_from_name(name) };
+
+            if (!selected) {
+                std::cerr << "Unknown engine: " << name << std::endl;
+                usage(argv[0]);
+            }
+
+            engine = *selected;
+        } else if (option == "--streaming") {
+            streaming = true;
+        } else if (option == "--batch") {
+            batch = true;
+        } else if (option == "--frames") {
+            frames = true;
+        } else if (option == "--validate") {
+            validate = true;
+        } else if (option.rfind("--pipeline=", 0) == 0) {
+            pipeline = Filter::Pipeline::parse(option.substr(std::string { "--pipeline=" }.size()));
+
+            if (!pipeline) {
+                usage(argv[0]);
+            }
+        } else if (option.rfind("--threads=", 0) == 0) {
+            auto parsed { Parallel::parse_threads(option.substr(std::string { "--threads=" }.size())) };
+
+            if (!parsed) {
+                std::cerr << "Thread count must be between 1 and " << Parallel::max_threads << ": " << option << std::endl;
+                usage(argv[0]);
+            }
+
+            threads = *parsed;
+        } else if (option.rfind("--shard=", 0) == 0) {
+            auto value { option.substr(std::string { "--shard=" }.size()) };
+            auto slash { value.find('/') };
+            auto index { std::strtoul(value.c_str(), nullptr, 10) };
+            auto count { slash == std::string::npos ? 0 : std::strtoul(value.c_str() + slash + 1, nullptr, 10) };
+
+            if (value.empty() || !std::isdigit(static_cast<unsigned char>(value[0])) || count == 0 || index >= count) {
+                std::cerr << "Invalid shard: " << value << std::endl;
+                usage(argv[0]);
+            }
+
+            sharding = std::pair { static_cast<unsigned>(index), static_cast<unsigned>(count) };
+        } else if (option.rfind("--affinity=", 0) == 0) {
+            auto affinity { Parallel::Affinity::parse(option.substr(std::string { "--affinity=" }.size())) };
+
+            if (!affinity) {
+                std::cerr << "Invalid or unavailable CPU list: " << option << std::endl;
+                usage(argv[0]);
+            }
+
+            Parallel::set_affinity(*affinity);
+        } else {
+            std::cerr << "Unknown option: " << option << std::endl;
+            usage(argv[0]);
+        }
+    }
+
+    if (pipeline) {
+        if (argc - arg != 2 || batch || streaming || frames || validate || sharding) {
+            usage(argv[0]);
+        }
+
+        PPM::Reader reader {};
+        PPM::Writer writer {};
+        Matrix m {}, result {};
+
+        if (!reader(argv[arg], m, threads)) {
+            return 1;
+        }
+
+        pipeline->run(m, result, threads);
+        return writer(result, argv[arg + 1], threads) ? 0 : 1;
+    }
+
+    if (frames && !sharding && argc - arg == 1) {
+        auto radius { parse_radius(argv[0], argv[arg]) };
+        return Batch::run_stream(STDIN_FILENO, STDOUT_FILENO, radius, engine, threads) > 0 ? 1 : 0;
+    }
+
+    if (argc - arg != 3) {
+        usage(argv[0]);
+    }
+
+    auto radius { parse_radius(argv[0], argv[arg]) };
+
+    if (sharding) {
+        // The halo only reproduces the rows of a full blur for kernels that
+        // end at the radius.
+        if (engine == Filter::Engine::iir || engine == Filter::Engine::box || engine == Filter::Engine::pyramid) {
+            std::cerr << "--shard needs the exact, tiled, fixed or float engine" << std::endl;
+            usage(argv[0]);
+        }
+        if (batch || streaming || frames || validate) {
+            usage(argv[0]);
+        }
+
+        return shard(sharding->first, sharding->second, radius, engine, threads, argv[arg + 1], argv[arg + 2]) ? 0 : 1;
+    }
+
+    if (frames) {
+        if (std::string { argv[arg + 1] } != "-" || std::string { argv[arg + 2] } != "-") {
+            std::cerr << "--frames reads stdin and writes stdout" << std::endl;
+            usage(argv[0]);
+        }
+
+        return Batch::run_stream(STDIN_FILENO, STDOUT_FILENO, radius, engine, threads) > 0 ? 1 : 0;
+    }
+
+    if (batch) {
+        std::error_code error {};
+        std::filesystem::create_directories(argv[arg + 2], error);
+
+        auto jobs { Batch::jobs(argv[arg + 1], argv[arg + 2]) };
+
+        if (!jobs) {
+            return 1;
+        }
+
+        auto failed { Batch::run(*jobs, radius, engine, threads) };
+
+        if (failed > 0) {
+            std::cerr << failed << " of " << jobs->size() << " images failed" << std::endl;
+        }
+
+        return failed > 0 ? 1 : 0;
+    }
+
+    if (streaming) {
+        if (engine != Filter::Engine::exact) {
+            std::cerr << "--streaming only supports the exact engine" << std::endl;
+            usage(argv[0]);
+        }
+
+        PPM::RowReader reader {};
+        PPM::RowWriter writer {};
+
+        if (!reader.open(argv[arg + 1])
+            || !writer.open(argv[arg + 2], reader.get_x_size(), reader.get_y_size(), reader.get_color_max())) {
+            return 1;
+        }
+
+        auto ok { Filter::blur_streaming(reader, writer, radius) };
+        return writer.close() && ok ? 0 : 1;
     }
 
     PPM::Reader reader {};
     PPM::Writer writer {};
 
-    auto m { reader(argv[2]) };
-    auto radius { static_cast<unsigned>(std::stoul(argv[1])) };
+    // Only 8-bit colour images go through the engines; P5 and 16-bit
+    // images keep their format and take the exact blur.
+    auto header { reader.probe(argv[arg + 1]) };
+
+    if (!header) {
+        return 1;
+    }
+
+    if (header->channels != 3 || header->color_max > 255) {
+        if (engine != Filter::Engine::exact || validate) {
+            std::cerr << "Grey and 16-bit images only support the exact engine" << std::endl;
+            usage(argv[0]);
+        }
+
+        auto input { argv[arg + 1] }, output { argv[arg + 2] };
+        auto ok { header->channels == 1
+                ? (header->color_max > 255 ? blur_format<GrayMatrix16>(radius, threads, input, output) : blur_format<GrayMatrix>(radius, threads, input, output))
+                : blur_format<Matrix16>(radius, threads, input, output) };
 
-    auto blurred { Filter::blur(m, radius) };
-    writer(blurred, argv[3]);
+        return ok ? 0 : 1;
+    }
+
+    Matrix m {};
+
+    if (!reader(argv[arg + 1], m, threads)) {
+        return 1;
+    }
+
+    Matrix blurred {};
+
+    {
+        Profile::Scope scope { "blur" };
+        blurred = threads > 1 ? Filter::blur_par(m, radius, threads, engine) : Filter::blur(m, radius, engine);
+    }
+
+    if (!writer(blurred, argv[arg + 2], threads)) {
+        return 1;
+    }
+
+    if (validate) {
+        auto reference { threads > 1 ? Filter::blur_par(m, radius, threads) : Filter::blur(m, radius) };
+        auto difference { Filter::compare(blurred, reference) };
+
+        std::cerr << "max " << difference.max << " mean " << difference.mean << " psnr " << difference.psnr << std::endl;
+    }
 
     return 0;
 }
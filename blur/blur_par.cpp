@@ -0,0 +1,43 @@
+/*
+Author: David Holmqvist <daae19@student.bth.se>
+*/
+
+#include "matrix.hpp"
+#include "ppm.hpp"
+#include "filters.hpp"
+#include "parallel.hpp"
+#include <cstdlib>
+#include <iostream>
+
+int main(int argc, char const* argv[])
+{
+    if (argc != 5) {
+        std::cerr << "Usage: " << argv[0] << " [radius] [infile] [outfile] [threads]" << std::endl;
+        std::exit(1);
+    }
+
+    auto radius { Filter::parse_radius(argv[1]) };
+    auto threads { Parallel::parse_threads(argv[4]) };
+
+    if (!radius) {
+        std::cerr << "Radius must be between 1 and " << Filter::Gauss::max_radius << ": " << argv[1] << std::endl;
+        std::exit(1);
+    }
+
+    if (!threads) {
+        std::cerr << "Thread count must be between 1 and " << Parallel::max_threads << ": " << argv[4] << std::endl;
+        std::exit(1);
+    }
+
+    PPM::Reader reader {};
+    PPM::Writer writer {};
+    Matrix m {};
+
+    if (!reader(argv[2], m, *threads)) {
+        return 1;
+    }
+
+    auto blurred { Filter::blur_par(m, *radius, *threads) };
+
+    return writer(blurred, argv[3], *threads) ? 0 : 1;
+}
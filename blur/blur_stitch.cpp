@@ -0,0 +1,61 @@
+/*
+Author: David Holmqvist <daae19@student.bth.se>
+*/
+
+#include "ppm.hpp"
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+// Joins the strips written by blur --shard=I/N, given in shard order, into
+// one PPM. The strips are streamed row by row, so the joined image never has
+// to fit in memory, and the result is byte for byte what an unsharded blur
+// writes.
+
+int main(int argc, char const* argv[])
+{
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " [outfile] [strip...]" << std::endl;
+        std::exit(1);
+    }
+
+    std::vector<std::unique_ptr<PPM::RowReader>> strips {};
+    auto y_size { 0u };
+
+    for (auto arg { 2 }; arg < argc; arg++) {
+        auto& strip { strips.emplace_back(std::make_unique<PPM::RowReader>()) };
+
+        if (!strip->open(argv[arg])) {
+            return 1;
+        }
+
+        if (strip->get_x_size() != strips.front()->get_x_size() || strip->get_color_max() != strips.front()->get_color_max()) {
+            std::cerr << argv[arg] << " does not match the width and color max of " << argv[2] << std::endl;
+            return 1;
+        }
+
+        y_size += strip->get_y_size();
+    }
+
+    auto x_size { strips.front()->get_x_size() };
+    std::vector<unsigned char> R(x_size), G(x_size), B(x_size);
+    PPM::RowWriter writer {};
+
+    if (!writer.open(argv[1], x_size, y_size, strips.front()->get_color_max())) {
+        return 1;
+    }
+
+    for (auto& strip : strips) {
+        for (auto y { 0u }; y < strip->get_y_size(); y++) {
+            if (!strip->read_row(R.data(), G.data(), B.data())) {
+                writer.close();
+                return 1;
+            }
+
+            writer.write_row(R.data(), G.data(), B.data(), x_size);
+        }
+    }
+
+    return writer.close() ? 0 : 1;
+}
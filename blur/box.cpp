@@ -0,0 +1,93 @@
+/*
+Author: David Holmqvist <daae19@student.bth.se>
+*/
+
+#include "box.hpp"
+#include "filters.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace Filter
+{
+
+    namespace Box
+    {
+        namespace
+        {
+            // One box of half-width h over `length` samples, as a running
+            // sum. `count` tracks how many samples the window currently
+            // covers, so the average shrinks with the window at the edges.
+            // Intermediate boxes round to nearest; the last one truncates
+            // like the exact engine's store does.
+            void box(unsigned char const *in, unsigned char *out, unsigned length, unsigned h, bool round)
+            {
+                std::uint32_t sum{0}, count{0};
+
+                for (auto x{0u}; x <= h && x < length; x++)
+                {
+                    sum += in[x];
+                    count++;
+                }
+
+                for (auto x{0u}; x < length; x++)
+                {
+                    out[x] = (sum + (round ? count / 2 : 0)) / count;
+
+                    if (x + h + 1 < length)
+                    {
+                        sum += in[x + h + 1];
+                        count++;
+                    }
+                    if (x >= h)
+                    {
+                        sum -= in[x - h];
+                        count--;
+                    }
+                }
+            }
+        }
+
+        Widths::Widths(int radius)
+            : radii{}
+        {
+            // Same sigma as the exact kernel, see Iir::Coefficients.
+            auto sigma{radius / (Gauss::max_x * std::sqrt(2.0 * Gauss::pi))};
+
+            // Largest odd width not above the ideal one, and the number of
+            // boxes that keep it (Kovesi's m) so that, with the rest one odd
+            // width wider, the variances add up to sigma^2.
+            auto ideal{std::sqrt(12.0 * sigma * sigma / passes + 1.0)};
+            auto lower{static_cast<int>(std::floor(ideal))};
+            if (lower % 2 == 0)
+            {
+                lower--;
+            }
+            auto upper{lower + 2};
+            auto narrower{static_cast<int>(std::round((12.0 * sigma * sigma - passes * lower * lower - 4.0 * passes * lower - 3.0 * passes) / (-4.0 * lower - 4.0)))};
+
+            for (auto i{0}; i < static_cast<int>(passes); i++)
+            {
+                auto width{i < narrower ? lower : upper};
+                radii[i] = std::max(width, 1) / 2;
+            }
+        }
+
+        void blur_rows(unsigned char const *src, std::size_t src_stride, unsigned char *dst, std::size_t dst_stride, unsigned length, const Widths &widths, unsigned y_begin, unsigned y_end)
+        {
+            // Kept per thread so that repeated blurs do not allocate.
+            thread_local std::vector<unsigned char> a{}, b{};
+            a.resize(length);
+            b.resize(length);
+
+            for (auto y{y_begin}; y < y_end; y++)
+            {
+                box(src + y * src_stride, a.data(), length, widths.radii[0], true);
+                box(a.data(), b.data(), length, widths.radii[1], true);
+                box(b.data(), dst + y * dst_stride, length, widths.radii[2], false);
+            }
+        }
+    }
+
+}
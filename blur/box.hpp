@@ -0,0 +1,51 @@
+/*
+Author: David Holmqvist <daae19@student.bth.se>
+*/
+
+#include <cstddef>
+#if !defined(BOX_HPP)
+#define BOX_HPP
+
+namespace Filter
+{
+
+    // Three successive box blurs, each a running integer sum over the row,
+    // converge on a Gaussian (central limit theorem) at constant cost per
+    // pixel. Box widths follow Kovesi ("Fast almost-Gaussian filtering",
+    // DICTA 2010) for the sigma of Gauss::get_weights(). Near the edges each
+    // box only averages the samples inside the row, the same shrinking
+    // window the exact engine normalizes by.
+    //
+    // Error against the exact engine, see Filter::Engine:
+    //
+    //   radius    max    mean
+    //        3     15    0.76
+    //       15      9    0.28
+    //       40     19    0.35
+    //      100     20    0.65
+    //      300     18    1.54
+    //
+    // Meant for previews: the box cascade has a piecewise quadratic
+    // profile, so hard edges come out visibly different at large radii.
+    namespace Box
+    {
+        constexpr unsigned passes{3};
+
+        class Widths
+        {
+        public:
+            // Half-width of each box: pass i averages 2 * radii[i] + 1
+            // samples.
+            unsigned radii[passes];
+
+            Widths(int radius);
+        };
+
+        // Blurs the rows [y_begin, y_end) of a plane of `length` pixel rows
+        // into dst; rows lie src_stride and dst_stride pixels apart.
+        void blur_rows(unsigned char const *src, std::size_t src_stride, unsigned char *dst, std::size_t dst_stride, unsigned length, const Widths &widths, unsigned y_begin, unsigned y_end);
+    }
+
+}
+
+#endif
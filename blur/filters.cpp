@@ -3,9 +3,26 @@ Author: David Holmqvist <daae19@student.bth.se>
 */
 
 #include "filters.hpp"
+#include "box.hpp"
+#include "fixed.hpp"
+#include "iir.hpp"
 #include "matrix.hpp"
+#include "parallel.hpp"
+#include "profile.hpp"
 #include "ppm.hpp"
+#include "pyramid.hpp"
+#include "simd.hpp"
+#include "single.hpp"
+#include "tiled.hpp"
+#include <algorithm>
+#include <array>
+#include <cctype>
 #include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <thread>
+#include <utility>
+#include <vector>
 
 namespace Filter
 {
@@ -20,89 +37,561 @@ namespace Filter
                 weights_out[i] = exp(-x * x * pi);
             }
         }
+
+        Kernel::Kernel(int radius)
+            : radius{radius}, weights(radius + 1), normalized(radius + 1), sums(radius + 1)
+        {
+            Gauss::get_weights(radius, weights.data());
+
+            // sums[d] is the normalizer of a pixel d taps from one edge and
+            // at least radius taps from the other; sums[radius] is the
+            // interior one. The near tap is added before the far one, just
+            // as the tap loop does.
+            for (auto d{0}; d <= radius; d++)
+            {
+                auto n{weights[0]};
+
+                for (auto wi{1}; wi <= radius; wi++)
+                {
+                    if (wi <= d)
+                    {
+                        n += weights[wi];
+                    }
+                    n += weights[wi];
+                }
+                sums[d] = n;
+            }
+
+            for (auto i{0}; i <= radius; i++)
+            {
+                normalized[i] = weights[i] / sums[radius];
+            }
+        }
+
+        const Kernel &Kernel::get(int radius)
+        {
+            return per_radius<Kernel>(radius, [radius] { return new Kernel{radius}; });
+        }
+
+        int Kernel::get_radius() const
+        {
+            return radius;
+        }
+
+        const double *Kernel::get_weights() const
+        {
+            return weights.data();
+        }
+
+        const double *Kernel::get_normalized() const
+        {
+            return normalized.data();
+        }
+
+        double Kernel::sum(int before, int after) const
+        {
+            if (std::max(before, after) >= radius)
+            {
+                return sums[std::min({before, after, radius})];
+            }
+
+            // Both edges cut the kernel off, only happens on images
+            // narrower than the kernel itself.
+            auto n{weights[0]};
+
+            for (auto wi{1}; wi <= radius; wi++)
+            {
+                if (wi <= before)
+                {
+                    n += weights[wi];
+                }
+                if (wi <= after)
+                {
+                    n += weights[wi];
+                }
+            }
+
+            return n;
+        }
     }
 
-    Matrix blur(Matrix m, const int radius)
+    namespace
     {
-        Matrix scratch{PPM::max_dimension};
-        auto dst{m};
-
-        for (auto x{0}; x < dst.get_x_size(); x++)
+        // The weighted taps around pixel x of a size wide row. Near an edge
+        // the taps on both sides run out at different distances. Up to the
+        // nearer one both sides are added, as in the interior; beyond it only
+        // the far side has taps left. Splitting the loop there keeps the
+        // order of the additions without a bounds check per tap.
+        template <typename Pixel>
+        double tap_sum(Pixel const *in, int x, int size, const Gauss::Kernel &kernel)
         {
-            for (auto y{0}; y < dst.get_y_size(); y++)
+            auto radius{kernel.get_radius()};
+            auto w{kernel.get_weights()};
+            auto left{std::min(x, radius)}, right{std::min(size - 1 - x, radius)};
+            auto both{std::min(left, right)};
+            auto v{w[0] * in[x]};
+
+            for (auto wi{1}; wi <= both; wi++)
             {
-                double w[Gauss::max_radius]{};
-                Gauss::get_weights(radius, w);
+                v += w[wi] * in[x - wi];
+                v += w[wi] * in[x + wi];
+            }
+            for (auto wi{both + 1}; wi <= left; wi++)
+            {
+                v += w[wi] * in[x - wi];
+            }
+            for (auto wi{both + 1}; wi <= right; wi++)
+            {
+                v += w[wi] * in[x + wi];
+            }
 
-                // unsigned char Matrix::r(unsigned x, unsigned y) const
-                // {
-                //     return R[y * x_size + x];
-                // }
+            return v;
+        }
+    }
 
-                auto r{w[0] * dst.r(x, y)}, g{w[0] * dst.g(x, y)}, b{w[0] * dst.b(x, y)}, n{w[0]};
+    // One-dimensional Gauss pass over the pixels [x_begin, x_end) of one
+    // x_size wide row. Only the first and last radius pixels of a row need
+    // the bounds checks; the interior is a plain multiply-add over both
+    // sides of the kernel, handed to the widest SIMD variant the CPU
+    // supports.
+    void blur_span(unsigned char const *in, unsigned char *out, unsigned x_size, const Gauss::Kernel &kernel, unsigned x_begin, unsigned x_end)
+    {
+        auto radius{kernel.get_radius()};
+        auto w{kernel.get_weights()};
+        auto size{static_cast<int>(x_size)};
+        auto begin{static_cast<int>(x_begin)}, end{static_cast<int>(x_end)};
+        auto interior_begin{std::min(radius, size)};
+        auto interior_end{std::max(size - radius, interior_begin)};
 
-                for (auto wi{1}; wi <= radius; wi++)
+        auto edge{[&](int x) {
+            out[x - begin] = tap_sum(in, x, size, kernel) / kernel.sum(x, size - 1 - x);
+        }};
+
+        for (auto x{begin}; x < std::min(interior_begin, end); x++)
+        {
+            edge(x);
+        }
+
+        // The row kernel indexes relative to its pointers, so shifting both
+        // by begin lets it write straight into a span-sized out.
+        auto first{std::max(interior_begin, begin)}, last{std::min(interior_end, end)};
+
+        if (first < last)
+        {
+            Simd::row_kernel()(in + begin, out, first - begin, last - begin, w, radius, kernel.sum(radius, radius));
+        }
+
+        for (auto x{std::max(interior_end, begin)}; x < end; x++)
+        {
+            edge(x);
+        }
+    }
+
+    // The vertical pass reuses this on the transposed image, so every tap
+    // is a unit-stride load.
+    void blur_rows(unsigned char const *src, std::size_t src_stride, unsigned char *dst, std::size_t dst_stride, unsigned length, const Gauss::Kernel &kernel, unsigned y_begin, unsigned y_end)
+    {
+        for (auto y{y_begin}; y < y_end; y++)
+        {
+            blur_span(src + y * src_stride, dst + y * dst_stride, length, kernel, 0, length);
+        }
+    }
+
+    namespace
+    {
+        // Edge length of the square tiles used by transpose(). 64x64 bytes
+        // for the source and destination tile together fit comfortably in
+        // L1, and each tile row is exactly one cache line.
+        constexpr unsigned transpose_tile{64};
+
+        // Writes the rows [x_begin, x_end) of the transpose of a plane with
+        // y_size rows into dst, that is its columns [x_begin, x_end), one
+        // transpose_tile square at a time so that neither the row reads nor
+        // the column writes thrash the cache. Rows lie src_stride and
+        // dst_stride pixels apart.
+        template <typename Pixel>
+        void transpose(Pixel const *src, std::size_t src_stride, Pixel *dst, std::size_t dst_stride, unsigned y_size, unsigned x_begin, unsigned x_end)
+        {
+            for (auto tx{x_begin}; tx < x_end; tx += transpose_tile)
+            {
+                auto tx_end{std::min(tx + transpose_tile, x_end)};
+
+                for (auto ty{0u}; ty < y_size; ty += transpose_tile)
                 {
-                    auto wc{w[wi]};
-                    auto x2{x - wi};
-                    if (x2 >= 0)
+                    auto ty_end{std::min(ty + transpose_tile, y_size)};
+
+                    for (auto y{ty}; y < ty_end; y++)
                     {
-                        r += wc * dst.r(x2, y);
-                        g += wc * dst.g(x2, y);
-                        b += wc * dst.b(x2, y);
-                        n += wc;
+                        for (auto x{tx}; x < tx_end; x++)
+                        {
+                            dst[x * dst_stride + y] = src[y * src_stride + x];
+                        }
                     }
-                    x2 = x + wi;
-                    if (x2 < dst.get_x_size())
+                }
+            }
+        }
+
+        // A one-dimensional blur of the rows [y_begin, y_end) of a plane made
+        // of `length` wide rows with the engine and radius it was built for.
+        // All per-radius tables are cached, so building one never allocates.
+        class RowPass
+        {
+        private:
+            Engine engine;
+            const Gauss::Kernel *kernel;
+            const Iir::Coefficients *coefficients;
+            const Fixed::Weights *weights;
+            Box::Widths widths;
+
+        public:
+            RowPass(const Engine engine, const int radius)
+                : engine{engine},
+                  kernel{engine == Engine::exact || engine == Engine::single ? &Gauss::Kernel::get(radius) : nullptr},
+                  coefficients{engine == Engine::iir ? &Iir::Coefficients::get(radius) : nullptr},
+                  weights{engine == Engine::fixed ? &Fixed::Weights::get(radius) : nullptr},
+                  widths{radius}
+            {
+            }
+
+            // The rows of src and dst lie src_stride and dst_stride pixels
+            // apart.
+            void operator()(unsigned char const *src, std::size_t src_stride, unsigned char *dst, std::size_t dst_stride, unsigned length, unsigned y_begin, unsigned y_end) const
+            {
+                switch (engine)
+                {
+                case Engine::iir:
+                    Iir::blur_rows(src, src_stride, dst, dst_stride, length, *coefficients, y_begin, y_end);
+                    break;
+                case Engine::box:
+                    Box::blur_rows(src, src_stride, dst, dst_stride, length, widths, y_begin, y_end);
+                    break;
+                case Engine::fixed:
+                    Fixed::blur_rows(src, src_stride, dst, dst_stride, length, *weights, y_begin, y_end);
+                    break;
+                case Engine::single:
+                    Single::blur_rows(src, src_stride, dst, dst_stride, length, *kernel, y_begin, y_end);
+                    break;
+                case Engine::exact:
+                case Engine::tiled:
+                case Engine::pyramid:
+                    blur_rows(src, src_stride, dst, dst_stride, length, *kernel, y_begin, y_end);
+                    break;
+                }
+            }
+        };
+
+        // The exact engine's pass over the rows of 16-bit planes, the same
+        // sums as blur_span() in plain scalar code.
+        class WidePass
+        {
+        private:
+            const Gauss::Kernel *kernel;
+
+        public:
+            WidePass(const int radius)
+                : kernel{&Gauss::Kernel::get(radius)}
+            {
+            }
+
+            void operator()(std::uint16_t const *src, std::size_t src_stride, std::uint16_t *dst, std::size_t dst_stride, unsigned length, unsigned y_begin, unsigned y_end) const
+            {
+                for (auto y{y_begin}; y < y_end; y++)
+                {
+                    auto in{src + y * src_stride};
+                    auto out{dst + y * dst_stride};
+                    auto size{static_cast<int>(length)};
+
+                    for (auto x{0}; x < size; x++)
                     {
-                        r += wc * dst.r(x2, y);
-                        g += wc * dst.g(x2, y);
-                        b += wc * dst.b(x2, y);
-                        n += wc;
+                        out[x] = tap_sum(in, x, size, *kernel) / kernel->sum(x, size - 1 - x);
                     }
                 }
-                scratch.r(x, y) = r / n;
-                scratch.g(x, y) = g / n;
-                scratch.b(x, y) = b / n;
             }
-        }
+        };
 
-        for (auto x{0}; x < dst.get_x_size(); x++)
+        // The four stages of the separable blur: blur rows, transpose, blur
+        // the rows of the transposed image (the original columns) and
+        // transpose back, over every channel of an Image with a Pass for its
+        // pixel type. Stage `i` may only start once every band of stage
+        // `i - 1` is done, since a transpose reads across all bands. The
+        // intermediate planes are padded: their rows start on a cache line
+        // and, being an odd number of lines apart, the column writes of a
+        // transpose spread over all cache sets even when a side of the image
+        // is a power of two.
+        //
+        // Every stage is split by the rows it writes: band i of the image
+        // rows in stages 0 and 3, band i of the transposed rows in stages 1
+        // and 2. The worker that writes a row in one stage is thus the one
+        // that reads it in the next, and since it is also the first to touch
+        // it, a fresh page lands on that worker's NUMA node.
+        template <typename Image, typename Pass>
+        class Stages
         {
-            for (auto y{0}; y < dst.get_y_size(); y++)
+        private:
+            const Image &src;
+            Image &dst;
+            Image &scratch;
+            Image &transposed;
+            Image &transposed_blurred;
+            Pass pass;
+
+        public:
+            Stages(const Image &src, Image &dst, Image &scratch, Image &transposed, Image &transposed_blurred, Pass pass)
+                : src{src}, dst{dst}, scratch{scratch}, transposed{transposed}, transposed_blurred{transposed_blurred}, pass{pass}
             {
-                double w[Gauss::max_radius]{};
-                Gauss::get_weights(radius, w);
+                auto x_size{src.get_x_size()}, y_size{src.get_y_size()};
 
-                auto r{w[0] * scratch.r(x, y)}, g{w[0] * scratch.g(x, y)}, b{w[0] * scratch.b(x, y)}, n{w[0]};
+                dst.resize(x_size, y_size, dst.get_layout());
+                dst.set_color_max(src.get_color_max());
+                scratch.resize(x_size, y_size, Image::Layout::padded);
+                transposed.resize(y_size, x_size, Image::Layout::padded);
+                transposed_blurred.resize(y_size, x_size, Image::Layout::padded);
+            }
 
-                for (auto wi{1}; wi <= radius; wi++)
+            static constexpr unsigned count{4};
+
+            void run(unsigned stage, unsigned index, unsigned bands)
+            {
+                Profile::Scope scope{stage == 0 ? "horizontal" : stage == 2 ? "vertical" : "transpose"};
+                auto x_size{src.get_x_size()}, y_size{src.get_y_size()};
+
+                switch (stage)
                 {
-                    auto wc{w[wi]};
-                    auto y2{y - wi};
-                    if (y2 >= 0)
+                case 0:
+                {
+                    auto [begin, end]{Parallel::band(index, bands, y_size)};
+                    for (auto c{0u}; c < Image::channels; c++)
+                    {
+                        pass(src.get_plane(c), src.get_stride(), scratch.get_plane(c), scratch.get_stride(), x_size, begin, end);
+                    }
+                    break;
+                }
+                case 1:
+                {
+                    auto [begin, end]{Parallel::band(index, bands, x_size)};
+                    for (auto c{0u}; c < Image::channels; c++)
+                    {
+                        transpose(scratch.get_plane(c), scratch.get_stride(), transposed.get_plane(c), transposed.get_stride(), y_size, begin, end);
+                    }
+                    break;
+                }
+                case 2:
+                {
+                    auto [begin, end]{Parallel::band(index, bands, x_size)};
+                    for (auto c{0u}; c < Image::channels; c++)
+                    {
+                        pass(transposed.get_plane(c), transposed.get_stride(), transposed_blurred.get_plane(c), transposed_blurred.get_stride(), y_size, begin, end);
+                    }
+                    break;
+                }
+                case 3:
+                {
+                    auto [begin, end]{Parallel::band(index, bands, y_size)};
+                    for (auto c{0u}; c < Image::channels; c++)
                     {
-                        r += wc * scratch.r(x, y2);
-                        g += wc * scratch.g(x, y2);
-                        b += wc * scratch.b(x, y2);
-                        n += wc;
+                        transpose(transposed_blurred.get_plane(c), transposed_blurred.get_stride(), dst.get_plane(c), dst.get_stride(), x_size, begin, end);
                     }
-                    y2 = y + wi;
-                    if (y2 < dst.get_y_size())
+                    break;
+                }
+                }
+            }
+
+            // All stages on the calling thread, or split over `threads`
+            // workers that meet at a barrier between stages.
+            void run(unsigned threads)
+            {
+                if (threads <= 1)
+                {
+                    for (auto stage{0u}; stage < count; stage++)
                     {
-                        r += wc * scratch.r(x, y2);
-                        g += wc * scratch.g(x, y2);
-                        b += wc * scratch.b(x, y2);
-                        n += wc;
+                        run(stage, 0, 1);
                     }
+                    return;
+                }
+
+                Parallel::Barrier barrier{threads};
+                std::vector<std::thread> workers{};
+
+                for (auto i{0u}; i < threads; i++)
+                {
+                    workers.emplace_back([&, i] {
+                        Parallel::pin(i);
+
+                        for (auto stage{0u}; stage < count; stage++)
+                        {
+                            if (stage > 0)
+                            {
+                                barrier.wait();
+                            }
+                            run(stage, i, threads);
+                        }
+                    });
+                }
+
+                for (auto &worker : workers)
+                {
+                    worker.join();
                 }
-                dst.r(x, y) = r / n;
-                dst.g(x, y) = g / n;
-                dst.b(x, y) = b / n;
             }
+        };
+
+        template <typename Image, typename Pass>
+        void run_stages(const Image &m, Image &dst, Image &scratch, Image &transposed, Image &transposed_blurred, Pass pass, unsigned threads)
+        {
+            Stages<Image, Pass>{m, dst, scratch, transposed, transposed_blurred, pass}.run(threads);
+        }
+    }
+
+    std::optional<Engine> engine_from_name(const std::string &name)
+    {
+        if (name == "exact")
+        {
+            return Engine::exact;
+        }
+        if (name == "iir")
+        {
+            return Engine::iir;
+        }
+        if (name == "box")
+        {
+            return Engine::box;
+        }
+        if (name == "tiled")
+        {
+            return Engine::tiled;
+        }
+        if (name == "fixed")
+        {
+            return Engine::fixed;
+        }
+        if (name == "float")
+        {
+            return Engine::single;
+        }
+        if (name == "pyramid")
+        {
+            return Engine::pyramid;
         }
 
+        return std::nullopt;
+    }
+
+    std::optional<int> parse_radius(const std::string &text)
+    {
+        char *end{};
+        auto radius{std::strtoul(text.c_str(), &end, 10)};
+
+        if (text.empty() || !std::isdigit(static_cast<unsigned char>(text[0])) || *end != '\0' || radius < 1 || radius > Gauss::max_radius)
+        {
+            return std::nullopt;
+        }
+
+        return static_cast<int>(radius);
+    }
+
+    Difference compare(const Matrix &a, const Matrix &b)
+    {
+        auto x_size{a.get_x_size()}, y_size{a.get_y_size()};
+        std::size_t count{static_cast<std::size_t>(x_size) * y_size};
+        auto max{0};
+        auto total{0.0};
+        auto squares{0.0};
+
+        for (auto [p, q] : {std::pair{a.get_R(), b.get_R()}, std::pair{a.get_G(), b.get_G()}, std::pair{a.get_B(), b.get_B()}})
+        {
+            for (auto y{0u}; y < y_size; y++)
+            {
+                auto row_p{p + y * a.get_stride()}, row_q{q + y * b.get_stride()};
+
+                for (auto x{0u}; x < x_size; x++)
+                {
+                    auto d{std::abs(row_p[x] - row_q[x])};
+                    max = std::max(max, d);
+                    total += d;
+                    squares += d * d;
+                }
+            }
+        }
+
+        auto mean{count > 0 ? total / (3 * count) : 0.0};
+        auto error{count > 0 ? squares / (3 * count) : 0.0};
+        auto peak{static_cast<double>(std::max(a.get_color_max(), 1u))};
+
+        return {max, mean, error > 0 ? 10 * std::log10(peak * peak / error) : std::numeric_limits<double>::infinity()};
+    }
+
+    void blur(const Matrix &m, Matrix &dst, const int radius, const Engine engine, Workspace &workspace)
+    {
+        if (engine == Engine::tiled)
+        {
+            Tiled::blur(m, dst, radius, 1, workspace);
+            return;
+        }
+        if (engine == Engine::pyramid)
+        {
+            Pyramid::blur(m, dst, radius, 1, workspace);
+            return;
+        }
+
+        run_stages(m, dst, workspace.scratch, workspace.transposed, workspace.transposed_blurred, RowPass{engine, radius}, 1);
+    }
+
+    void blur_par(const Matrix &m, Matrix &dst, const int radius, const unsigned threads, const Engine engine, Workspace &workspace)
+    {
+        if (engine == Engine::tiled)
+        {
+            Tiled::blur(m, dst, radius, threads, workspace);
+            return;
+        }
+        if (engine == Engine::pyramid)
+        {
+            Pyramid::blur(m, dst, radius, threads, workspace);
+            return;
+        }
+
+        run_stages(m, dst, workspace.scratch, workspace.transposed, workspace.transposed_blurred, RowPass{engine, radius}, threads);
+    }
+
+    Matrix blur(const Matrix &m, const int radius, const Engine engine)
+    {
+        thread_local Workspace workspace{};
+        Matrix dst{};
+
+        blur(m, dst, radius, engine, workspace);
+
         return dst;
     }
 
+    Matrix blur_par(const Matrix &m, const int radius, const unsigned threads, const Engine engine)
+    {
+        thread_local Workspace workspace{};
+        Matrix dst{};
+
+        blur_par(m, dst, radius, threads, engine, workspace);
+
+        return dst;
+    }
+
+    template <typename Pixel, unsigned Channels>
+    void blur(const BasicMatrix<Pixel, Channels> &m, BasicMatrix<Pixel, Channels> &dst, const int radius, const unsigned threads)
+    {
+        using Image = BasicMatrix<Pixel, Channels>;
+
+        thread_local Image scratch{}, transposed{}, transposed_blurred{};
+
+        if constexpr (sizeof(Pixel) == 1)
+        {
+            run_stages(m, dst, scratch, transposed, transposed_blurred, RowPass{Engine::exact, radius}, threads);
+        }
+        else
+        {
+            run_stages(m, dst, scratch, transposed, transposed_blurred, WidePass{radius}, threads);
+        }
+    }
+
+    template void blur(const Matrix &, Matrix &, const int, const unsigned);
+    template void blur(const GrayMatrix &, GrayMatrix &, const int, const unsigned);
+    template void blur(const Matrix16 &, Matrix16 &, const int, const unsigned);
+    template void blur(const GrayMatrix16 &, GrayMatrix16 &, const int, const unsigned);
+
 }
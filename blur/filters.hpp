@@ -3,6 +3,12 @@ Author: David Holmqvist <daae19@student.bth.se>
 */
 
 #include "matrix.hpp"
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
 
 #if !defined(FILTERS_HPP)
 #define FILTERS_HPP
@@ -10,6 +16,26 @@ Author: David Holmqvist <daae19@student.bth.se>
 namespace Filter
 {
 
+    // The one T built by make() for radius, kept for the life of the
+    // process; every later call with that radius returns the same object.
+    // make returns a new T; one cache exists per (T, make) pair.
+    template <typename T, typename Make>
+    const T &per_radius(int radius, Make make)
+    {
+        static std::mutex mutex{};
+        static std::map<int, std::unique_ptr<T>> cache{};
+
+        std::lock_guard<std::mutex> lock{mutex};
+        auto &entry{cache[radius]};
+
+        if (!entry)
+        {
+            entry.reset(make());
+        }
+
+        return *entry;
+    }
+
     namespace Gauss
     {
         constexpr unsigned max_radius{1000};
@@ -17,10 +43,141 @@ namespace Filter
         constexpr float pi{3.14159};
 
         void get_weights(int n, double *weights_out);
+
+        // The weights of one radius together with the normalizers blur()
+        // divides by, accumulated in the same order as the tap loop so the
+        // result is bit-identical to summing them per pixel. Build through
+        // get(), which caches one Kernel per radius for the process.
+        class Kernel
+        {
+        private:
+            int radius;
+            std::vector<double> weights;
+            std::vector<double> normalized;
+            std::vector<double> sums;
+
+            Kernel(int radius);
+
+        public:
+            static const Kernel &get(int radius);
+
+            int get_radius() const;
+
+            // w[0..radius], as produced by get_weights().
+            const double *get_weights() const;
+
+            // w[0..radius] divided by the interior normalizer, for engines
+            // that trade exactness for a plain multiply-add.
+            const double *get_normalized() const;
+
+            // Normalizer of a pixel `before` taps from one edge and `after`
+            // taps from the other.
+            double sum(int before, int after) const;
+        };
     }
 
-    Matrix blur(Matrix m, const int radius);
+    // The exact engine's one-dimensional pass over the pixels
+    // [x_begin, x_end) of one x_size wide row, written to out[0..x_end - x_begin).
+    void blur_span(unsigned char const *in, unsigned char *out, unsigned x_size, const Gauss::Kernel &kernel, unsigned x_begin, unsigned x_end);
+
+    // The exact engine's one-dimensional pass over the rows [y_begin, y_end)
+    // of a plane of `length` pixel rows, src_stride and dst_stride apart.
+    void blur_rows(unsigned char const *src, std::size_t src_stride, unsigned char *dst, std::size_t dst_stride, unsigned length, const Gauss::Kernel &kernel, unsigned y_begin, unsigned y_end);
+
+    // The headers of the approximate engines tabulate their error against
+    // exact: the largest and mean absolute difference in 8-bit levels,
+    // pooled over R, G and B, on data/im1.ppm (676x763) and data/im2.ppm
+    // (1024x1024). blur --validate reports the same figures for any input.
+    enum class Engine
+    {
+        // The reference: truncated Gauss kernel, computed in double.
+        exact,
+        // Recursive approximation, constant cost per pixel, see iir.hpp.
+        iir,
+        // Three running-sum box blurs, constant cost per pixel, see box.hpp.
+        box,
+        // The exact result, both passes fused per L2-sized tile, see
+        // tiled.hpp.
+        tiled,
+        // 16-bit fixed-point weights, 32-bit integer sums, see fixed.hpp.
+        fixed,
+        // Single precision with fused multiply-adds, see single.hpp.
+        single,
+        // Exact blur of a downsampled copy, interpolated back up, for large
+        // radii, see pyramid.hpp.
+        pyramid,
+    };
+
+    // Looks up an engine by its command line name, e.g. "iir".
+    std::optional<Engine> engine_from_name(const std::string &name);
+
+    // A radius given on the command line: a number from 1 to
+    // Gauss::max_radius with nothing after it.
+    std::optional<int> parse_radius(const std::string &text);
+
+    // Largest and mean absolute difference between two images of the same
+    // size, in levels, taken over the samples of R, G and B together, and
+    // the peak signal-to-noise ratio of one against the other in dB
+    // (infinite when they are identical).
+    struct Difference
+    {
+        int max;
+        double mean;
+        double psnr;
+    };
+
+    Difference compare(const Matrix &a, const Matrix &b);
+
+    // Intermediate images of the separable passes. Handing the same
+    // Workspace to every blur of a frame sequence means they are allocated
+    // once, for the largest frame, instead of once per call.
+    class Workspace
+    {
+    public:
+        Matrix scratch;
+        Matrix transposed;
+        Matrix transposed_blurred;
+
+        // One tile buffer and tap list per worker of the tiled engine.
+        std::vector<unsigned char> tiles;
+        std::vector<unsigned char const *> taps;
+        std::vector<double> weights;
+
+        // Halved images of the pyramid engine followed by the blurred
+        // coarsest one, and its interpolation positions.
+        std::vector<Matrix> pyramid;
+        std::vector<unsigned> lower;
+        std::vector<float> weight;
+    };
+
+    // Blurs m into dst, which is resized to match m but keeps its planes
+    // when they are large enough: with a warmed-up dst and workspace this
+    // does not allocate.
+    void blur(const Matrix &m, Matrix &dst, const int radius, const Engine engine, Workspace &workspace);
+
+    // Same result as blur(), byte for byte, with the horizontal pass split
+    // into row bands and the vertical pass into column bands over `threads`
+    // worker threads; the tiled engine shares out its tiles instead, the
+    // pyramid engine its coarse blur and its output rows.
+    void blur_par(const Matrix &m, Matrix &dst, const int radius, const unsigned threads, const Engine engine, Workspace &workspace);
+
+    // Convenience forms returning a new image; they keep one Workspace per
+    // calling thread.
+    Matrix blur(const Matrix &m, const int radius, const Engine engine = Engine::exact);
+    Matrix blur_par(const Matrix &m, const int radius, const unsigned threads, const Engine engine = Engine::exact);
+
+    // The exact engine over any pixel format: 8 or 16-bit samples, one grey
+    // or three colour planes, on `threads` workers. A grey image costs a
+    // third of a colour one, and for a Matrix the result is that of
+    // blur_par() with Engine::exact.
+    template <typename Pixel, unsigned Channels>
+    void blur(const BasicMatrix<Pixel, Channels> &m, BasicMatrix<Pixel, Channels> &dst, const int radius, const unsigned threads = 1);
+
+    extern template void blur(const Matrix &, Matrix &, const int, const unsigned);
+    extern template void blur(const GrayMatrix &, GrayMatrix &, const int, const unsigned);
+    extern template void blur(const Matrix16 &, Matrix16 &, const int, const unsigned);
+    extern template void blur(const GrayMatrix16 &, GrayMatrix16 &, const int, const unsigned);
 
 }
 
-#endif
\ No newline at end of file
+#endif
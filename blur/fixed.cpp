@@ -0,0 +1,209 @@
+/*
+Author: David Holmqvist <daae19@student.bth.se>
+*/
+
+#include "fixed.hpp"
+#include "filters.hpp"
+#include "simd.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <immintrin.h>
+
+namespace Filter
+{
+
+    namespace Fixed
+    {
+        namespace
+        {
+            // The interior outputs out[begin..end), where every tap falls
+            // inside the row and the weights sum to exactly 1 << shift.
+            void interior_scalar(unsigned char const *in, unsigned char *out, int begin, int end, const Weights &weights)
+            {
+                auto q{weights.q.data()};
+
+                for (auto x{begin}; x < end; x++)
+                {
+                    std::int32_t v{q[0] * in[x]};
+
+                    for (auto t{1}; t <= weights.taps; t++)
+                    {
+                        v += q[t] * (in[x - t] + in[x + t]);
+                    }
+                    out[x] = v >> shift;
+                }
+            }
+
+            __attribute__((target("avx2"))) inline __m256i load_avx2(unsigned char const *p)
+            {
+                return _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<__m128i const *>(p)));
+            }
+
+            // Term t of a pixel: the center for t == 0, otherwise the sum of
+            // the two pixels t away, which fits 16 bits with room to spare.
+            __attribute__((target("avx2"))) inline __m256i term_avx2(unsigned char const *p, int t)
+            {
+                return t == 0 ? load_avx2(p) : _mm256_add_epi16(load_avx2(p - t), load_avx2(p + t));
+            }
+
+            // Sixteen pixels per step. Two terms are interleaved 16-bit wise
+            // so that one multiply-add applies a pair of weights; the unpack
+            // and the final pack both work within 128-bit lanes, so they
+            // cancel out and the pixels come back in order.
+            __attribute__((target("avx2"))) void interior_avx2(unsigned char const *in, unsigned char *out, int begin, int end, const Weights &weights)
+            {
+                constexpr int lanes{16};
+                auto x{begin};
+
+                for (; x + lanes <= end; x += lanes)
+                {
+                    auto lo{_mm256_setzero_si256()}, hi{_mm256_setzero_si256()};
+
+                    for (auto t{0}; t <= weights.taps; t += 2)
+                    {
+                        auto a{term_avx2(in + x, t)};
+                        auto b{t + 1 <= weights.taps ? term_avx2(in + x, t + 1) : _mm256_setzero_si256()};
+                        auto pair{_mm256_set1_epi32(weights.pairs[t / 2])};
+
+                        lo = _mm256_add_epi32(lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), pair));
+                        hi = _mm256_add_epi32(hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), pair));
+                    }
+
+                    lo = _mm256_srai_epi32(lo, shift);
+                    hi = _mm256_srai_epi32(hi, shift);
+
+                    auto words{_mm256_packs_epi32(lo, hi)};
+                    auto bytes{_mm256_permute4x64_epi64(_mm256_packus_epi16(words, words), 0x08)};
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + x), _mm256_castsi256_si128(bytes));
+                }
+
+                interior_scalar(in, out, x, end, weights);
+            }
+
+            using Interior = void (*)(unsigned char const *in, unsigned char *out, int begin, int end, const Weights &weights);
+
+            // Follows the ISA chosen for the exact engine, BLUR_ISA cap
+            // included; the 16-bit path needs AVX2.
+            Interior interior()
+            {
+                static const Interior selected{
+                    std::strcmp(Simd::row_kernel_name(), "avx2") == 0 || std::strcmp(Simd::row_kernel_name(), "avx512") == 0
+                        ? interior_avx2
+                        : interior_scalar};
+
+                return selected;
+            }
+        }
+
+        Weights::Weights(int radius)
+            : taps{0}
+        {
+            auto &kernel{Gauss::Kernel::get(radius)};
+            auto normalized{kernel.get_normalized()};
+
+            q.assign(radius + 1, 0);
+
+            for (auto t{1}; t <= radius; t++)
+            {
+                q[t] = std::lround(normalized[t] * (1 << shift));
+
+                if (q[t] > 0)
+                {
+                    taps = t;
+                }
+            }
+
+            // The center takes up whatever rounding left over, so the
+            // interior weights sum to exactly one.
+            std::int32_t sides{0};
+
+            for (auto t{1}; t <= taps; t++)
+            {
+                sides += q[t];
+            }
+
+            q.resize(taps + 1);
+            q[0] = (1 << shift) - 2 * sides;
+
+            pairs.assign(taps / 2 + 1, 0);
+
+            for (auto t{0}; t <= taps; t++)
+            {
+                auto word{static_cast<std::int32_t>(static_cast<std::uint16_t>(q[t]))};
+                pairs[t / 2] |= t % 2 == 0 ? word : word << 16;
+            }
+
+            prefix.assign(taps + 1, 0);
+
+            for (auto t{1}; t <= taps; t++)
+            {
+                prefix[t] = prefix[t - 1] + q[t];
+            }
+        }
+
+        std::int32_t Weights::total(int before, int after) const
+        {
+            return q[0] + prefix[std::min(before, taps)] + prefix[std::min(after, taps)];
+        }
+
+        const Weights &Weights::get(int radius)
+        {
+            return per_radius<Weights>(radius, [radius] { return new Weights{radius}; });
+        }
+
+        void blur_rows(unsigned char const *src, std::size_t src_stride, unsigned char *dst, std::size_t dst_stride, unsigned length, const Weights &weights, unsigned y_begin, unsigned y_end)
+        {
+            auto taps{weights.taps};
+            auto q{weights.q.data()};
+            auto size{static_cast<int>(length)};
+            auto interior_begin{std::min(taps, size)};
+            auto interior_end{std::max(size - taps, interior_begin)};
+            auto middle{interior()};
+
+            for (auto y{y_begin}; y < y_end; y++)
+            {
+                auto in{src + y * src_stride};
+                auto out{dst + y * dst_stride};
+
+                // No weight survived rounding (radius 0): the blur is the
+                // identity, and q[0] would not fit 16 bits.
+                if (taps == 0)
+                {
+                    std::copy(in, in + length, out);
+                    continue;
+                }
+
+                auto edge{[&](int x) {
+                    auto left{std::min(x, taps)}, right{std::min(size - 1 - x, taps)};
+                    std::int32_t v{q[0] * in[x]};
+
+                    for (auto t{1}; t <= left; t++)
+                    {
+                        v += q[t] * in[x - t];
+                    }
+                    for (auto t{1}; t <= right; t++)
+                    {
+                        v += q[t] * in[x + t];
+                    }
+
+                    auto total{weights.total(left, right)};
+                    out[x] = v / total;
+                }};
+
+                for (auto x{0}; x < interior_begin; x++)
+                {
+                    edge(x);
+                }
+
+                middle(in, out, interior_begin, interior_end, weights);
+
+                for (auto x{interior_end}; x < size; x++)
+                {
+                    edge(x);
+                }
+            }
+        }
+    }
+
+}
@@ -0,0 +1,127 @@
+/*
+Author: David Holmqvist <daae19@student.bth.se>
+*/
+
+#include "iir.hpp"
+#include "filters.hpp"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace Filter
+{
+
+    namespace Iir
+    {
+        namespace
+        {
+            // Zero samples kept on both sides of a row so the recursions
+            // never need a bounds check.
+            constexpr unsigned pad{3};
+
+            // Runs the causal and then the anti-causal recursion in place
+            // over v[pad, pad + length). v must have `pad` slots on either
+            // side, the leading ones set to zero.
+            void recurse(double *v, unsigned length, const Coefficients &c)
+            {
+                auto end{pad + length};
+
+                for (auto n{pad}; n < end; n++)
+                {
+                    v[n] = c.b * v[n] + c.a[0] * v[n - 1] + c.a[1] * v[n - 2] + c.a[2] * v[n - 3];
+                }
+
+                for (auto i{0}; i < 3; i++)
+                {
+                    v[end + i] = c.tail[i][0] * v[end - 1] + c.tail[i][1] * v[end - 2] + c.tail[i][2] * v[end - 3];
+                }
+
+                for (auto n{end}; n-- > pad;)
+                {
+                    v[n] = c.b * v[n] + c.a[0] * v[n + 1] + c.a[1] * v[n + 2] + c.a[2] * v[n + 3];
+                }
+            }
+        }
+
+        Coefficients::Coefficients(int radius)
+            : b{}, a{}, tail{}
+        {
+            // Matches exp(-(i * max_x / radius)^2 * pi) = exp(-i^2 / (2 sigma^2)).
+            auto sigma{std::max(radius / (Gauss::max_x * std::sqrt(2.0 * Gauss::pi)), 0.5)};
+            auto q{sigma >= 2.5 ? 0.98711 * sigma - 0.96330 : 3.97156 - 4.14554 * std::sqrt(1.0 - 0.26891 * sigma)};
+            auto q2{q * q}, q3{q2 * q};
+
+            auto b0{1.57825 + 2.44413 * q + 1.4281 * q2 + 0.422205 * q3};
+            auto b1{2.44413 * q + 2.85619 * q2 + 1.26661 * q3};
+            auto b2{-(1.4281 * q2 + 1.26661 * q3)};
+            auto b3{0.422205 * q3};
+
+            a[0] = b1 / b0;
+            a[1] = b2 / b0;
+            a[2] = b3 / b0;
+            b = 1.0 - (a[0] + a[1] + a[2]);
+
+            // Column k of the tail map is the anti-causal state reached when
+            // the causal state at the end of a row is the k-th unit vector
+            // and the row carries on with zeros. The impulse response has
+            // decayed far below double precision after ten sigma.
+            auto extension{static_cast<unsigned>(std::ceil(10.0 * sigma)) + 32};
+
+            for (auto k{0}; k < 3; k++)
+            {
+                std::vector<double> v(extension + 2 * pad);
+                v[pad - 1 - k] = 1.0;
+
+                auto end{pad + extension};
+
+                for (auto n{pad}; n < end; n++)
+                {
+                    v[n] = a[0] * v[n - 1] + a[1] * v[n - 2] + a[2] * v[n - 3];
+                }
+
+                for (auto n{end}; n-- > pad;)
+                {
+                    v[n] = b * v[n] + a[0] * v[n + 1] + a[1] * v[n + 2] + a[2] * v[n + 3];
+                }
+
+                for (auto i{0u}; i < 3; i++)
+                {
+                    tail[i][k] = v[pad + i];
+                }
+            }
+        }
+
+        const Coefficients &Coefficients::get(int radius)
+        {
+            return per_radius<Coefficients>(radius, [radius] { return new Coefficients{radius}; });
+        }
+
+        void blur_rows(unsigned char const *src, std::size_t src_stride, unsigned char *dst, std::size_t dst_stride, unsigned length, const Coefficients &c, unsigned y_begin, unsigned y_end)
+        {
+            // The response to an all-ones row is the sum of the kernel
+            // weights that fall inside the row at each position, i.e. the
+            // normalizer of the clipped kernel.
+            thread_local std::vector<double> norm{}, v{};
+            norm.assign(length + 2 * pad, 0.0);
+            v.resize(length + 2 * pad);
+            std::fill(norm.begin() + pad, norm.end() - pad, 1.0);
+            recurse(norm.data(), length, c);
+
+            for (auto y{y_begin}; y < y_end; y++)
+            {
+                auto in{src + y * src_stride};
+                auto out{dst + y * dst_stride};
+
+                std::fill(v.begin(), v.begin() + pad, 0.0);
+                std::copy(in, in + length, v.begin() + pad);
+                recurse(v.data(), length, c);
+
+                for (auto x{0u}; x < length; x++)
+                {
+                    out[x] = std::clamp(v[pad + x] / norm[pad + x], 0.0, 255.0);
+                }
+            }
+        }
+    }
+
+}
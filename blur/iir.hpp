@@ -0,0 +1,64 @@
+/*
+Author: David Holmqvist <daae19@student.bth.se>
+*/
+
+#include <cstddef>
+#if !defined(IIR_HPP)
+#define IIR_HPP
+
+namespace Filter
+{
+
+    // Recursive Gaussian after Young and van Vliet ("Recursive
+    // implementation of the Gaussian filter", Signal Processing 44, 1995):
+    // a third-order causal pass followed by an anti-causal one, which costs
+    // the same handful of multiply-adds per pixel whatever the radius.
+    //
+    // The sigma matching a radius is the one of Gauss::get_weights(), i.e.
+    // sigma = radius / (max_x * sqrt(2 * pi)). Edges are handled by running
+    // the same recursion over an all-ones row and dividing by it, which
+    // reproduces the exact engine's renormalization of the clipped kernel.
+    //
+    // Error against the exact engine, see Filter::Engine:
+    //
+    //   radius    max    mean
+    //        3     16    0.47
+    //       15      8    0.53
+    //       40      5    0.59
+    //      100      3    0.48
+    //      300      6    1.21
+    //
+    // Small radii suffer from the third-order fit being poor below sigma of
+    // about 1 (radius 3 is sigma 0.9); the largest errors sit on hard edges.
+    // At radii approaching the image size the difference is dominated by the
+    // exact kernel being cut off at `radius` while the recursive one has an
+    // untruncated tail.
+    namespace Iir
+    {
+        class Coefficients
+        {
+        public:
+            // y[n] = b * x[n] + a[0] * y[n - 1] + a[1] * y[n - 2] + a[2] * y[n - 3]
+            double b;
+            double a[3];
+
+            // Maps the last three causal outputs of a row to the anti-causal
+            // state just past its end, as if the row continued with zeros
+            // forever (Triggs and Sdika, 2006, solved numerically).
+            double tail[3][3];
+
+            // Cached per radius for the process, like Gauss::Kernel.
+            static const Coefficients &get(int radius);
+
+        private:
+            Coefficients(int radius);
+        };
+
+        // Blurs the rows [y_begin, y_end) of a plane of `length` pixel rows
+        // into dst; rows lie src_stride and dst_stride pixels apart.
+        void blur_rows(unsigned char const *src, std::size_t src_stride, unsigned char *dst, std::size_t dst_stride, unsigned length, const Coefficients &c, unsigned y_begin, unsigned y_end);
+    }
+
+}
+
+#endif
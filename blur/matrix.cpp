@@ -3,166 +3,279 @@ Author: David Holmqvist <daae19@student.bth.se>
 */
 
 #include "matrix.hpp"
-#include "ppm.hpp"
-#include <fstream>
-#include <stdexcept>
-
-Matrix::Matrix(unsigned char* R, unsigned char* G, unsigned char* B, unsigned x_size, unsigned y_size, unsigned color_max)
-    : R { R }
-    , G { G }
-    , B { B }
-    , x_size { x_size }
-    , y_size { y_size }
-    , color_max { color_max }
-{
-}
-
-Matrix::Matrix()
-    : Matrix {
-        nullptr,
-        nullptr,
-        nullptr,
-        0,
-        0,
-        0,
-    }
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <utility>
+
+namespace {
+
+std::size_t round_up(std::size_t n, std::size_t multiple)
 {
+    return (n + multiple - 1) / multiple * multiple;
+}
+
 }
 
-Matrix::Matrix(unsigned dimension)
-    : R { new unsigned char[dimension * dimension] }
-    , G { new unsigned char[dimension * dimension] }
-    , B { new unsigned char[dimension * dimension] }
-    , x_size { dimension }
-    , y_size { dimension }
+template <typename Pixel, unsigned Channels>
+BasicMatrix<Pixel, Channels>::BasicMatrix()
+    : storage { nullptr }
+    , planes {}
+    , x_size { 0 }
+    , y_size { 0 }
     , color_max { 0 }
+    , layout { Layout::compact }
+    , stride { 0 }
+    , capacity { 0 }
 {
 }
 
-Matrix::Matrix(const Matrix& other)
-    : R { new unsigned char[other.x_size * other.y_size] }
-    , G { new unsigned char[other.x_size * other.y_size] }
-    , B { new unsigned char[other.x_size * other.y_size] }
-    , x_size { other.x_size }
-    , y_size { other.y_size }
-    , color_max { other.color_max }
+template <typename Pixel, unsigned Channels>
+BasicMatrix<Pixel, Channels>::BasicMatrix(unsigned dimension)
+    : BasicMatrix { dimension, dimension }
 {
-    for (auto x { 0 }; x < x_size; x++) {
-        for (auto y { 0 }; y < y_size; y++) {
-            auto &r_val { r(x, y) }, &g_val { g(x, y) }, &b_val { b(x, y) };
-            auto other_r_val { other.r(x, y) }, other_g_val { other.g(x, y) }, other_b_val { other.b(x, y) };
+}
 
-            r_val = other_r_val;
-            g_val = other_g_val;
-            b_val = other_b_val;
-        }
-    }
+template <typename Pixel, unsigned Channels>
+BasicMatrix<Pixel, Channels>::BasicMatrix(unsigned x_size, unsigned y_size, Layout layout)
+    : BasicMatrix {}
+{
+    resize(x_size, y_size, layout);
 }
 
-Matrix& Matrix::operator=(const Matrix other)
+template <typename Pixel, unsigned Channels>
+BasicMatrix<Pixel, Channels>::BasicMatrix(const BasicMatrix& other)
+    : BasicMatrix {}
+{
+    *this = other;
+}
+
+template <typename Pixel, unsigned Channels>
+BasicMatrix<Pixel, Channels>::BasicMatrix(BasicMatrix&& other) noexcept
+    : BasicMatrix {}
+{
+    *this = std::move(other);
+}
+
+template <typename Pixel, unsigned Channels>
+BasicMatrix<Pixel, Channels>& BasicMatrix<Pixel, Channels>::operator=(const BasicMatrix& other)
 {
     if (this == &other) {
         return *this;
     }
 
-    this->~Matrix();
-
-    R = new unsigned char[other.x_size * other.y_size];
-    G = new unsigned char[other.x_size * other.y_size];
-    B = new unsigned char[other.x_size * other.y_size];
-
-    x_size = other.x_size;
-    y_size = other.y_size;
+    resize(other.x_size, other.y_size, other.layout);
     color_max = other.color_max;
 
-    for (auto x { 0 }; x < x_size; x++) {
-        for (auto y { 0 }; y < y_size; y++) {
-            auto &r_val { r(x, y) }, &g_val { g(x, y) }, &b_val { b(x, y) };
-            auto other_r_val { other.r(x, y) }, other_g_val { other.g(x, y) }, other_b_val { other.b(x, y) };
+    for (auto c { 0u }; c < Channels; c++) {
+        if (is_contiguous() && other.is_contiguous()) {
+            std::copy_n(other.planes[c], x_size * y_size, planes[c]);
+            continue;
+        }
 
-            r_val = other_r_val;
-            g_val = other_g_val;
-            b_val = other_b_val;
+        for (auto y { 0u }; y < y_size; y++) {
+            std::copy_n(other.planes[c] + y * other.stride, x_size, planes[c] + y * stride);
         }
     }
 
     return *this;
 }
 
-Matrix::~Matrix()
+template <typename Pixel, unsigned Channels>
+BasicMatrix<Pixel, Channels>& BasicMatrix<Pixel, Channels>::operator=(BasicMatrix&& other) noexcept
+{
+    std::swap(storage, other.storage);
+    std::swap(planes, other.planes);
+    std::swap(x_size, other.x_size);
+    std::swap(y_size, other.y_size);
+    std::swap(color_max, other.color_max);
+    std::swap(layout, other.layout);
+    std::swap(stride, other.stride);
+    std::swap(capacity, other.capacity);
+
+    return *this;
+}
+
+template <typename Pixel, unsigned Channels>
+BasicMatrix<Pixel, Channels>::~BasicMatrix()
+{
+    std::free(storage);
+    storage = nullptr;
+    std::fill_n(planes, Channels, nullptr);
+    x_size = y_size = color_max = 0;
+    stride = capacity = 0;
+}
+
+template <typename Pixel, unsigned Channels>
+void BasicMatrix<Pixel, Channels>::resize(unsigned x_size, unsigned y_size, Layout layout)
 {
-    if (R) {
-        delete[] R;
-        R = nullptr;
+    // Worked out in bytes, which cache lines are counted in; a line always
+    // holds a whole number of pixels.
+    std::size_t stride_bytes { x_size * sizeof(Pixel) };
+
+    if (layout == Layout::padded) {
+        stride_bytes = round_up(stride_bytes, alignment);
+
+        if (stride_bytes / alignment % 2 == 0) {
+            stride_bytes += alignment;
+        }
     }
-    if (G) {
-        delete[] G;
-        G = nullptr;
+
+    std::size_t stride { stride_bytes / sizeof(Pixel) };
+    auto needed { static_cast<std::size_t>(y_size) * stride };
+
+    if (needed > capacity) {
+        // Round each plane up to whole cache lines so all of them stay
+        // aligned.
+        auto plane { round_up(needed * sizeof(Pixel), alignment) };
+        auto larger { static_cast<Pixel*>(std::aligned_alloc(alignment, Channels * plane)) };
+
+        if (!larger) {
+            throw std::bad_alloc {};
+        }
+
+        std::free(storage);
+        storage = larger;
+        capacity = plane / sizeof(Pixel);
     }
-    if (B) {
-        delete[] B;
-        B = nullptr;
+
+    this->x_size = x_size;
+    this->y_size = y_size;
+    this->layout = layout;
+    this->stride = stride;
+
+    for (auto c { 0u }; c < Channels; c++) {
+        planes[c] = storage ? storage + c * capacity : nullptr;
     }
+}
 
-    x_size = y_size = color_max = 0;
+template <typename Pixel, unsigned Channels>
+void BasicMatrix<Pixel, Channels>::set_color_max(unsigned color_max)
+{
+    this->color_max = color_max;
 }
 
-unsigned Matrix::get_x_size() const
+template <typename Pixel, unsigned Channels>
+unsigned BasicMatrix<Pixel, Channels>::get_x_size() const
 {
     return x_size;
 }
 
-unsigned Matrix::get_y_size() const
+template <typename Pixel, unsigned Channels>
+unsigned BasicMatrix<Pixel, Channels>::get_y_size() const
 {
     return y_size;
 }
 
-unsigned Matrix::get_color_max() const
+template <typename Pixel, unsigned Channels>
+unsigned BasicMatrix<Pixel, Channels>::get_color_max() const
 {
     return color_max;
 }
 
-unsigned char const* Matrix::get_R() const
+template <typename Pixel, unsigned Channels>
+typename BasicMatrix<Pixel, Channels>::Layout BasicMatrix<Pixel, Channels>::get_layout() const
+{
+    return layout;
+}
+
+template <typename Pixel, unsigned Channels>
+std::size_t BasicMatrix<Pixel, Channels>::get_stride() const
+{
+    return stride;
+}
+
+template <typename Pixel, unsigned Channels>
+bool BasicMatrix<Pixel, Channels>::is_contiguous() const
+{
+    return stride == x_size;
+}
+
+template <typename Pixel, unsigned Channels>
+Pixel const* BasicMatrix<Pixel, Channels>::get_plane(unsigned c) const
 {
-    return R;
+    return planes[c];
 }
 
-unsigned char const* Matrix::get_G() const
+template <typename Pixel, unsigned Channels>
+Pixel* BasicMatrix<Pixel, Channels>::get_plane(unsigned c)
 {
-    return G;
+    return planes[c];
 }
 
-unsigned char const* Matrix::get_B() const
+template <typename Pixel, unsigned Channels>
+Pixel const* BasicMatrix<Pixel, Channels>::get_R() const
 {
-    return B;
+    return planes[0];
 }
 
-unsigned char Matrix::r(unsigned x, unsigned y) const
+template <typename Pixel, unsigned Channels>
+Pixel const* BasicMatrix<Pixel, Channels>::get_G() const
 {
-    return R[y * x_size + x];
+    return planes[1 % Channels];
 }
 
-unsigned char Matrix::g(unsigned x, unsigned y) const
+template <typename Pixel, unsigned Channels>
+Pixel const* BasicMatrix<Pixel, Channels>::get_B() const
 {
-    return G[y * x_size + x];
+    return planes[2 % Channels];
 }
 
-unsigned char Matrix::b(unsigned x, unsigned y) const
+template <typename Pixel, unsigned Channels>
+Pixel* BasicMatrix<Pixel, Channels>::get_R()
 {
-    return B[y * x_size + x];
+    return planes[0];
 }
 
-unsigned char& Matrix::r(unsigned x, unsigned y)
+template <typename Pixel, unsigned Channels>
+Pixel* BasicMatrix<Pixel, Channels>::get_G()
 {
-    return R[y * x_size + x];
+    return planes[1 % Channels];
 }
 
-unsigned char& Matrix::g(unsigned x, unsigned y)
+template <typename Pixel, unsigned Channels>
+Pixel* BasicMatrix<Pixel, Channels>::get_B()
 {
-    return G[y * x_size + x];
+    return planes[2 % Channels];
 }
 
-unsigned char& Matrix::b(unsigned x, unsigned y)
+template <typename Pixel, unsigned Channels>
+Pixel BasicMatrix<Pixel, Channels>::r(unsigned x, unsigned y) const
 {
-    return B[y * x_size + x];
+    return get_R()[y * stride + x];
 }
+
+template <typename Pixel, unsigned Channels>
+Pixel BasicMatrix<Pixel, Channels>::g(unsigned x, unsigned y) const
+{
+    return get_G()[y * stride + x];
+}
+
+template <typename Pixel, unsigned Channels>
+Pixel BasicMatrix<Pixel, Channels>::b(unsigned x, unsigned y) const
+{
+    return get_B()[y * stride + x];
+}
+
+template <typename Pixel, unsigned Channels>
+Pixel& BasicMatrix<Pixel, Channels>::r(unsigned x, unsigned y)
+{
+    return get_R()[y * stride + x];
+}
+
+template <typename Pixel, unsigned Channels>
+Pixel& BasicMatrix<Pixel, Channels>::g(unsigned x, unsigned y)
+{
+    return get_G()[y * stride + x];
+}
+
+template <typename Pixel, unsigned Channels>
+Pixel& BasicMatrix<Pixel, Channels>::b(unsigned x, unsigned y)
+{
+    return get_B()[y * stride + x];
+}
+
+template class BasicMatrix<unsigned char, 3>;
+template class BasicMatrix<unsigned char, 1>;
+template class BasicMatrix<std::uint16_t, 3>;
+template class BasicMatrix<std::uint16_t, 1>;
@@ -2,43 +2,106 @@
 Author: David Holmqvist <daae19@student.bth.se>
 */
 
+#include <cstddef>
+#include <cstdint>
 #include <iostream>
 
 #if !defined(MATRIX_HPP)
 #define MATRIX_HPP
 
-class Matrix {
+// An image of `Channels` planes of `Pixel` samples. Instantiated for 8- and
+// 16-bit samples with one (grey) or three (RGB) channels, see the aliases
+// below; Matrix, 8-bit RGB, is what most of the code works with.
+template <typename Pixel, unsigned Channels>
+class BasicMatrix {
+public:
+    using pixel_type = Pixel;
+    static constexpr unsigned channels { Channels };
+
+    // Every plane, and every row of a padded one, starts on a cache line.
+    static constexpr unsigned alignment { 64 };
+
+    // How the rows of a plane are laid out. Compact rows follow each other
+    // directly, get_stride() == get_x_size(), which is what the PPM codecs
+    // and most engines read and produce. Padded rows are a whole, odd,
+    // number of cache lines apart, so that the rows of a column land in
+    // different cache sets even for power-of-two widths.
+    enum class Layout {
+        compact,
+        padded,
+    };
+
 private:
-    unsigned char* R;
-    unsigned char* G;
-    unsigned char* B;
+    // One allocation holding all planes.
+    Pixel* storage;
+    Pixel* planes[Channels];
 
     unsigned x_size;
     unsigned y_size;
     unsigned color_max;
+    Layout layout;
+    // Pixels from one row to the next.
+    std::size_t stride;
+    // Pixels each plane has room for.
+    std::size_t capacity;
 
 public:
-    Matrix();
-    Matrix(unsigned dimension);
-    Matrix(const Matrix& other);
-    Matrix(unsigned char* R, unsigned char* G, unsigned char* B, unsigned x_size, unsigned y_size, unsigned color_max);
-    Matrix& operator=(const Matrix other);
-    ~Matrix();
+    BasicMatrix();
+    BasicMatrix(unsigned dimension);
+    BasicMatrix(unsigned x_size, unsigned y_size, Layout layout = Layout::compact);
+    BasicMatrix(const BasicMatrix& other);
+    BasicMatrix(BasicMatrix&& other) noexcept;
+    BasicMatrix& operator=(const BasicMatrix& other);
+    BasicMatrix& operator=(BasicMatrix&& other) noexcept;
+    ~BasicMatrix();
+
+    // Changes the dimensions and layout, keeping the current planes
+    // whenever they are large enough. Pixel contents are unspecified
+    // afterwards.
+    void resize(unsigned x_size, unsigned y_size, Layout layout = Layout::compact);
+    void set_color_max(unsigned color_max);
 
     unsigned get_x_size() const;
     unsigned get_y_size() const;
     unsigned get_color_max() const;
+    Layout get_layout() const;
 
-    unsigned char const* get_R() const;
-    unsigned char const* get_G() const;
-    unsigned char const* get_B() const;
+    // Distance between the first pixels of two consecutive rows, in pixels.
+    std::size_t get_stride() const;
 
-    unsigned char r(unsigned x, unsigned y) const;
-    unsigned char g(unsigned x, unsigned y) const;
-    unsigned char b(unsigned x, unsigned y) const;
-    unsigned char& r(unsigned x, unsigned y);
-    unsigned char& g(unsigned x, unsigned y);
-    unsigned char& b(unsigned x, unsigned y);
+    // Whether the rows follow each other without gaps, so that a plane can
+    // be walked as one x_size * y_size array.
+    bool is_contiguous() const;
+
+    // The first pixel of plane c; pixel (x, y) is at y * get_stride() + x.
+    Pixel const* get_plane(unsigned c) const;
+    Pixel* get_plane(unsigned c);
+
+    // The planes by color. A grey image has the same plane for all three,
+    // just as a grey pixel has the same value in each.
+    Pixel const* get_R() const;
+    Pixel const* get_G() const;
+    Pixel const* get_B() const;
+    Pixel* get_R();
+    Pixel* get_G();
+    Pixel* get_B();
+
+    Pixel r(unsigned x, unsigned y) const;
+    Pixel g(unsigned x, unsigned y) const;
+    Pixel b(unsigned x, unsigned y) const;
+    Pixel& r(unsigned x, unsigned y);
+    Pixel& g(unsigned x, unsigned y);
+    Pixel& b(unsigned x, unsigned y);
 };
 
-#endif
\ No newline at end of file
+using Matrix = BasicMatrix<unsigned char, 3>;
+using GrayMatrix = BasicMatrix<unsigned char, 1>;
+using Matrix16 = BasicMatrix<std::uint16_t, 3>;
+using GrayMatrix16 = BasicMatrix<std::uint16_t, 1>;
+
+extern template class BasicMatrix<unsigned char, 3>;
+extern template class BasicMatrix<unsigned char, 1>;
+extern template class BasicMatrix<std::uint16_t, 3>;
+extern template class BasicMatrix<std::uint16_t, 1>;
+
+#endif
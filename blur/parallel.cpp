@@ -0,0 +1,145 @@
+/*
+Author: David Holmqvist <daae19@student.bth.se>
+*/
+
+#include "parallel.hpp"
+#include <cctype>
+#include <cstdlib>
+#include <pthread.h>
+#include <sched.h>
+#include <sstream>
+
+namespace Parallel
+{
+
+    Barrier::Barrier(unsigned count)
+        : count{count}, waiting{0}, generation{0}
+    {
+    }
+
+    void Barrier::wait()
+    {
+        std::unique_lock<std::mutex> lock{mutex};
+        auto arrived_generation{generation};
+
+        if (++waiting == count)
+        {
+            waiting = 0;
+            generation++;
+            cv.notify_all();
+            return;
+        }
+
+        cv.wait(lock, [&] { return generation != arrived_generation; });
+    }
+
+    std::pair<unsigned, unsigned> band(unsigned index, unsigned count, unsigned total)
+    {
+        auto size{total / count}, rest{total % count};
+        auto begin{index * size + (index < rest ? index : rest)};
+        auto end{begin + size + (index < rest ? 1 : 0)};
+
+        return {begin, end};
+    }
+
+    namespace
+    {
+        Affinity affinity{};
+    }
+
+    std::optional<Affinity> Affinity::parse(const std::string &list)
+    {
+        cpu_set_t allowed;
+
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        {
+            return std::nullopt;
+        }
+
+        Affinity parsed{};
+        std::istringstream items{list};
+
+        for (std::string item; std::getline(items, item, ',');)
+        {
+            unsigned first{}, last{};
+            char dash{};
+            std::istringstream range{item};
+
+            if (!(range >> first))
+            {
+                return std::nullopt;
+            }
+            last = first;
+            if (range >> dash && (dash != '-' || !(range >> last)))
+            {
+                return std::nullopt;
+            }
+            if (!range.eof() || last < first)
+            {
+                return std::nullopt;
+            }
+
+            for (auto cpu{first}; cpu <= last; cpu++)
+            {
+                if (cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &allowed))
+                {
+                    return std::nullopt;
+                }
+                parsed.cpus.push_back(cpu);
+            }
+        }
+
+        if (parsed.empty())
+        {
+            return std::nullopt;
+        }
+
+        return parsed;
+    }
+
+    bool Affinity::empty() const
+    {
+        return cpus.empty();
+    }
+
+    void Affinity::pin(unsigned worker) const
+    {
+        if (cpus.empty())
+        {
+            return;
+        }
+
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpus[worker % cpus.size()], &set);
+
+        // parse() only accepts CPUs the process may use, so this can only
+        // fail if the allowed set shrank since; the worker then simply
+        // stays unpinned.
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+
+    std::optional<unsigned> parse_threads(const std::string &text)
+    {
+        char *end{};
+        auto threads{std::strtoul(text.c_str(), &end, 10)};
+
+        if (text.empty() || !std::isdigit(static_cast<unsigned char>(text[0])) || *end != '\0' || threads < 1 || threads > max_threads)
+        {
+            return std::nullopt;
+        }
+
+        return static_cast<unsigned>(threads);
+    }
+
+    void set_affinity(Affinity affinity)
+    {
+        Parallel::affinity = std::move(affinity);
+    }
+
+    void pin(unsigned index)
+    {
+        affinity.pin(index);
+    }
+
+}
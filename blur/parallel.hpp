@@ -0,0 +1,114 @@
+/*
+Author: David Holmqvist <daae19@student.bth.se>
+*/
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if !defined(PARALLEL_HPP)
+#define PARALLEL_HPP
+
+namespace Parallel
+{
+
+    // Reusable barrier: every participating thread blocks in wait() until
+    // `count` threads have arrived, after which all of them are released.
+    class Barrier
+    {
+    private:
+        std::mutex mutex;
+        std::condition_variable cv;
+        unsigned count;
+        unsigned waiting;
+        unsigned generation;
+
+    public:
+        Barrier(unsigned count);
+
+        void wait();
+    };
+
+    // Bounded blocking FIFO: push() waits while `capacity` items are queued
+    // and pop() waits while none are.
+    template <typename T>
+    class Queue
+    {
+    private:
+        std::mutex mutex;
+        std::condition_variable not_empty;
+        std::condition_variable not_full;
+        std::deque<T> items;
+        std::size_t capacity;
+
+    public:
+        Queue(std::size_t capacity)
+            : capacity{capacity}
+        {
+        }
+
+        void push(T item)
+        {
+            std::unique_lock<std::mutex> lock{mutex};
+            not_full.wait(lock, [&] { return items.size() < capacity; });
+            items.push_back(std::move(item));
+            not_empty.notify_one();
+        }
+
+        T pop()
+        {
+            std::unique_lock<std::mutex> lock{mutex};
+            not_empty.wait(lock, [&] { return !items.empty(); });
+            auto item{std::move(items.front())};
+            items.pop_front();
+            not_full.notify_one();
+            return item;
+        }
+    };
+
+    // Splits [0, total) into `count` contiguous bands whose sizes differ by
+    // at most one and returns the [begin, end) range of band `index`.
+    std::pair<unsigned, unsigned> band(unsigned index, unsigned count, unsigned total);
+
+    // The CPUs workers run on: worker i is pinned to cpus[i % cpus.size()].
+    // Since worker i also owns band i of every pass, listing the CPUs of one
+    // NUMA node before those of the next keeps neighbouring bands, and the
+    // pages they first touched, on the same node.
+    class Affinity
+    {
+    private:
+        std::vector<unsigned> cpus;
+
+    public:
+        // Parses a list such as "0-7,16-23". Returns nothing when it is
+        // malformed or names a CPU this process may not run on.
+        static std::optional<Affinity> parse(const std::string &list);
+
+        bool empty() const;
+
+        // Pins the calling thread to the CPU of `worker`, if any.
+        void pin(unsigned worker) const;
+    };
+
+    // The affinity every parallel pass pins its workers with. Empty, leaving
+    // placement to the scheduler, until set; set it before starting work.
+    void set_affinity(Affinity affinity);
+
+    // Pins the calling thread as worker `index` of a parallel pass.
+    void pin(unsigned index);
+
+    // Most workers a command line may ask for.
+    constexpr unsigned max_threads{1024};
+
+    // A thread count given on the command line: a number from 1 to
+    // max_threads with nothing after it.
+    std::optional<unsigned> parse_threads(const std::string &text);
+
+}
+
+#endif
@@ -0,0 +1,593 @@
+/*
+Author: David Holmqvist <daae19@student.bth.se>
+*/
+
+#include "pipeline.hpp"
+#include "filters.hpp"
+#include "parallel.hpp"
+#include "simd.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+namespace Filter
+{
+
+    namespace
+    {
+        // The last `size` rows pushed into a stage, of some element type,
+        // indexed by their row number.
+        template <typename T>
+        class Ring
+        {
+        private:
+            std::vector<T> data;
+            unsigned x_size;
+            unsigned size;
+
+        public:
+            void start(unsigned x_size, unsigned rows)
+            {
+                this->x_size = x_size;
+                size = rows;
+                data.resize(static_cast<std::size_t>(x_size) * rows);
+            }
+
+            T *operator[](int y)
+            {
+                return data.data() + static_cast<std::size_t>(y % size) * x_size;
+            }
+        };
+
+        class Blur : public Stage
+        {
+        private:
+            const Gauss::Kernel &kernel;
+            Ring<unsigned char> ring;
+            std::vector<unsigned char const *> rows;
+            std::vector<double> weights;
+            unsigned x_size;
+            int y_size;
+
+        public:
+            Blur(int radius)
+                : kernel{Gauss::Kernel::get(radius)}, rows(2 * radius + 1), weights(2 * radius + 1), x_size{0}, y_size{0}
+            {
+            }
+
+            int reach() const override
+            {
+                return kernel.get_radius();
+            }
+
+            std::unique_ptr<Stage> clone() const override
+            {
+                return std::make_unique<Blur>(kernel.get_radius());
+            }
+
+            void start(unsigned x_size, unsigned y_size) override
+            {
+                this->x_size = x_size;
+                this->y_size = y_size;
+                ring.start(x_size, 2 * reach() + 1);
+            }
+
+            // The horizontal pass as rows come in, the vertical one from the
+            // ring, just as blur_streaming() does.
+            void push(int y, unsigned char const *row) override
+            {
+                blur_span(row, ring[y], x_size, kernel, 0, x_size);
+            }
+
+            void emit(int y, unsigned char *out) override
+            {
+                auto radius{reach()};
+                auto w{kernel.get_weights()};
+                auto taps{0};
+
+                rows[taps] = ring[y];
+                weights[taps++] = w[0];
+
+                for (auto wi{1}; wi <= radius; wi++)
+                {
+                    if (y - wi >= 0)
+                    {
+                        rows[taps] = ring[y - wi];
+                        weights[taps++] = w[wi];
+                    }
+                    if (y + wi < y_size)
+                    {
+                        rows[taps] = ring[y + wi];
+                        weights[taps++] = w[wi];
+                    }
+                }
+
+                Simd::column_kernel()(rows.data(), weights.data(), taps, out, x_size, kernel.sum(y, y_size - 1 - y));
+            }
+        };
+
+        class Mean : public Stage
+        {
+        private:
+            int radius;
+            // Horizontal window sums of the pushed rows, and their running
+            // vertical sum over the rows [top, bottom).
+            Ring<std::uint32_t> ring;
+            std::vector<std::uint32_t> column;
+            std::vector<std::uint32_t> widths;
+            unsigned x_size;
+            int y_size;
+            int top;
+            int bottom;
+
+        public:
+            Mean(int radius)
+                : radius{radius}, x_size{0}, y_size{0}, top{0}, bottom{0}
+            {
+            }
+
+            int reach() const override
+            {
+                return radius;
+            }
+
+            std::unique_ptr<Stage> clone() const override
+            {
+                return std::make_unique<Mean>(radius);
+            }
+
+            void start(unsigned x_size, unsigned y_size) override
+            {
+                this->x_size = x_size;
+                this->y_size = y_size;
+                top = bottom = -1;
+                // A row leaves the vertical sum only after the row radius
+                // below the next output has come in.
+                ring.start(x_size, 2 * radius + 2);
+                column.assign(x_size, 0);
+                widths.resize(x_size);
+
+                auto size{static_cast<int>(x_size)};
+
+                for (auto x{0}; x < size; x++)
+                {
+                    widths[x] = std::min(x + radius, size - 1) - std::max(x - radius, 0) + 1;
+                }
+            }
+
+            // Running sum along the row.
+            void push(int y, unsigned char const *row) override
+            {
+                auto sums{ring[y]};
+                auto size{static_cast<int>(x_size)};
+                std::uint32_t sum{0};
+
+                for (auto x{0}; x < std::min(radius, size); x++)
+                {
+                    sum += row[x];
+                }
+
+                for (auto x{0}; x < size; x++)
+                {
+                    if (x + radius < size)
+                    {
+                        sum += row[x + radius];
+                    }
+                    sums[x] = sum;
+                    if (x - radius >= 0)
+                    {
+                        sum -= row[x - radius];
+                    }
+                }
+            }
+
+            void emit(int y, unsigned char *out) override
+            {
+                auto first{std::max(y - radius, 0)}, last{std::min(y + radius + 1, y_size)};
+
+                if (top < 0)
+                {
+                    top = bottom = first;
+                }
+
+                for (; bottom < last; bottom++)
+                {
+                    auto sums{ring[bottom]};
+
+                    for (auto x{0u}; x < x_size; x++)
+                    {
+                        column[x] += sums[x];
+                    }
+                }
+
+                for (; top < first; top++)
+                {
+                    auto sums{ring[top]};
+
+                    for (auto x{0u}; x < x_size; x++)
+                    {
+                        column[x] -= sums[x];
+                    }
+                }
+
+                std::uint32_t height(last - first);
+
+                for (auto x{0u}; x < x_size; x++)
+                {
+                    out[x] = column[x] / (widths[x] * height);
+                }
+            }
+        };
+
+        class Unsharp : public Stage
+        {
+        private:
+            Blur blurred;
+            double amount;
+            Ring<unsigned char> ring;
+            std::vector<unsigned char> row;
+            unsigned x_size;
+
+        public:
+            Unsharp(int radius, double amount)
+                : blurred{radius}, amount{amount}, x_size{0}
+            {
+            }
+
+            int reach() const override
+            {
+                return blurred.reach();
+            }
+
+            std::unique_ptr<Stage> clone() const override
+            {
+                return std::make_unique<Unsharp>(reach(), amount);
+            }
+
+            void start(unsigned x_size, unsigned y_size) override
+            {
+                this->x_size = x_size;
+                blurred.start(x_size, y_size);
+                ring.start(x_size, reach() + 1);
+                row.resize(x_size);
+            }
+
+            void push(int y, unsigned char const *in) override
+            {
+                blurred.push(y, in);
+                std::copy(in, in + x_size, ring[y]);
+            }
+
+            void emit(int y, unsigned char *out) override
+            {
+                auto in{ring[y]};
+
+                blurred.emit(y, row.data());
+
+                for (auto x{0u}; x < x_size; x++)
+                {
+                    auto v{in[x] + amount * (in[x] - row[x])};
+                    out[x] = std::clamp(std::lround(v), 0l, 255l);
+                }
+            }
+        };
+
+        class Sobel : public Stage
+        {
+        private:
+            Ring<unsigned char> ring;
+            unsigned x_size;
+            int y_size;
+
+        public:
+            Sobel()
+                : x_size{0}, y_size{0}
+            {
+            }
+
+            int reach() const override
+            {
+                return 1;
+            }
+
+            std::unique_ptr<Stage> clone() const override
+            {
+                return std::make_unique<Sobel>();
+            }
+
+            void start(unsigned x_size, unsigned y_size) override
+            {
+                this->x_size = x_size;
+                this->y_size = y_size;
+                ring.start(x_size, 3);
+            }
+
+            void push(int y, unsigned char const *row) override
+            {
+                std::copy(row, row + x_size, ring[y]);
+            }
+
+            void emit(int y, unsigned char *out) override
+            {
+                auto above{ring[std::max(y - 1, 0)]}, middle{ring[y]}, below{ring[std::min(y + 1, y_size - 1)]};
+                auto last{x_size - 1};
+
+                for (auto x{0u}; x < x_size; x++)
+                {
+                    auto left{x > 0 ? x - 1 : 0}, right{std::min(x + 1, last)};
+                    auto gx{(above[right] - above[left]) + 2 * (middle[right] - middle[left]) + (below[right] - below[left])};
+                    auto gy{(below[left] + 2 * below[x] + below[right]) - (above[left] + 2 * above[x] + above[right])};
+
+                    out[x] = std::min(std::sqrt(static_cast<double>(gx * gx + gy * gy)), 255.0);
+                }
+            }
+        };
+
+        // One worker's copy of the chain, with a row buffer between every
+        // two stages, running one plane of one band at a time.
+        class Chain
+        {
+        private:
+            std::vector<std::unique_ptr<Stage>> stages;
+            std::vector<std::vector<unsigned char>> buffers;
+            std::vector<int> next;
+            unsigned char const *src;
+            std::size_t src_stride;
+            unsigned x_size;
+            int y_size;
+
+            // Emits row y of stage s into out, first pulling the input rows
+            // it needs from stage s - 1, or from src for the first stage.
+            void pull(std::size_t s, int y, unsigned char *out)
+            {
+                auto &stage{*stages[s]};
+                auto need{std::min(y + stage.reach() + 1, y_size)};
+
+                for (; next[s] < need; next[s]++)
+                {
+                    if (s == 0)
+                    {
+                        stage.push(next[s], src + next[s] * src_stride);
+                    }
+                    else
+                    {
+                        pull(s - 1, next[s], buffers[s].data());
+                        stage.push(next[s], buffers[s].data());
+                    }
+                }
+
+                stage.emit(y, out);
+            }
+
+        public:
+            Chain(const std::vector<std::unique_ptr<Stage>> &prototypes)
+                : buffers(prototypes.size()), next(prototypes.size()), src{nullptr}, src_stride{0}, x_size{0}, y_size{0}
+            {
+                for (auto &stage : prototypes)
+                {
+                    stages.push_back(stage->clone());
+                }
+            }
+
+            // Rows [y_begin, y_end) of one plane, whose rows lie src_stride
+            // and dst_stride pixels apart.
+            void run(unsigned char const *src, std::size_t src_stride, unsigned char *dst, std::size_t dst_stride, unsigned x_size, unsigned y_size, int y_begin, int y_end)
+            {
+                this->src = src;
+                this->src_stride = src_stride;
+                this->x_size = x_size;
+                this->y_size = y_size;
+
+                // Stage s has to produce the rows of the band widened by the
+                // reach of every stage after it; its first input row is
+                // that much further up again.
+                auto after{0};
+
+                for (auto s{stages.size()}; s-- > 0;)
+                {
+                    next[s] = std::max(y_begin - after - stages[s]->reach(), 0);
+                    after += stages[s]->reach();
+
+                    stages[s]->start(x_size, y_size);
+                    buffers[s].resize(x_size);
+                }
+
+                for (auto y{y_begin}; y < y_end; y++)
+                {
+                    pull(stages.size() - 1, y, dst + y * dst_stride);
+                }
+            }
+        };
+
+        // Band height for a chain of total `reach`: tall enough that the
+        // recomputed halo rows stay a minor cost.
+        constexpr int min_band{64};
+
+        bool parse_int(const std::string &text, int &value)
+        {
+            char *end{};
+            auto parsed{std::strtol(text.c_str(), &end, 10)};
+
+            value = parsed;
+            return !text.empty() && *end == '\0' && parsed >= 1 && parsed <= static_cast<long>(Gauss::max_radius);
+        }
+
+        bool parse_double(const std::string &text, double &value)
+        {
+            char *end{};
+            value = std::strtod(text.c_str(), &end);
+
+            return !text.empty() && *end == '\0' && std::isfinite(value);
+        }
+    }
+
+    namespace Stages
+    {
+        std::unique_ptr<Stage> blur(int radius)
+        {
+            return std::make_unique<Blur>(radius);
+        }
+
+        std::unique_ptr<Stage> box(int radius)
+        {
+            return std::make_unique<Mean>(radius);
+        }
+
+        std::unique_ptr<Stage> unsharp(int radius, double amount)
+        {
+            return std::make_unique<Unsharp>(radius, amount);
+        }
+
+        std::unique_ptr<Stage> sobel()
+        {
+            return std::make_unique<Sobel>();
+        }
+    }
+
+    Pipeline::Pipeline(const Pipeline &other)
+    {
+        for (auto &stage : other.stages)
+        {
+            stages.push_back(stage->clone());
+        }
+    }
+
+    Pipeline &Pipeline::operator=(Pipeline other)
+    {
+        stages = std::move(other.stages);
+        return *this;
+    }
+
+    Pipeline &Pipeline::add(std::unique_ptr<Stage> stage)
+    {
+        stages.push_back(std::move(stage));
+        return *this;
+    }
+
+    std::optional<Pipeline> Pipeline::parse(const std::string &spec)
+    {
+        Pipeline pipeline{};
+        std::istringstream chain{spec};
+        std::string text{};
+
+        while (std::getline(chain, text, ','))
+        {
+            std::vector<std::string> fields{};
+            std::istringstream parts{text};
+            std::string field{};
+
+            while (std::getline(parts, field, ':'))
+            {
+                fields.push_back(field);
+            }
+
+            auto name{fields.empty() ? std::string{} : fields[0]};
+            auto radius{0};
+            auto amount{0.0};
+
+            if (name == "blur" && fields.size() == 2 && parse_int(fields[1], radius))
+            {
+                pipeline.add(Stages::blur(radius));
+            }
+            else if (name == "box" && fields.size() == 2 && parse_int(fields[1], radius))
+            {
+                pipeline.add(Stages::box(radius));
+            }
+            else if (name == "unsharp" && fields.size() == 3 && parse_int(fields[1], radius) && parse_double(fields[2], amount))
+            {
+                pipeline.add(Stages::unsharp(radius, amount));
+            }
+            else if (name == "sobel" && fields.size() == 1)
+            {
+                pipeline.add(Stages::sobel());
+            }
+            else
+            {
+                std::cerr << "Invalid pipeline stage \"" << text << "\": expected blur:RADIUS, box:RADIUS, unsharp:RADIUS:AMOUNT or sobel, with RADIUS in [1, " << Gauss::max_radius << "]" << std::endl;
+                return std::nullopt;
+            }
+        }
+
+        if (pipeline.empty())
+        {
+            std::cerr << "Empty pipeline" << std::endl;
+            return std::nullopt;
+        }
+
+        return pipeline;
+    }
+
+    bool Pipeline::empty() const
+    {
+        return stages.empty();
+    }
+
+    int Pipeline::reach() const
+    {
+        auto total{0};
+
+        for (auto &stage : stages)
+        {
+            total += stage->reach();
+        }
+
+        return total;
+    }
+
+    void Pipeline::run(const Matrix &m, Matrix &dst, const unsigned threads) const
+    {
+        auto x_size{m.get_x_size()};
+        auto y_size{static_cast<int>(m.get_y_size())};
+
+        dst.resize(x_size, y_size, dst.get_layout());
+        dst.set_color_max(m.get_color_max());
+
+        unsigned char const *src_planes[3]{m.get_R(), m.get_G(), m.get_B()};
+        unsigned char *dst_planes[3]{dst.get_R(), dst.get_G(), dst.get_B()};
+
+        // One band per worker would leave the last ones idle when bands
+        // differ in cost; four per worker evens that out.
+        auto height{threads > 1 ? std::max({(y_size + 4 * static_cast<int>(threads) - 1) / (4 * static_cast<int>(threads)), min_band, 2 * reach()}) : y_size};
+        auto bands{static_cast<unsigned>((y_size + height - 1) / height)};
+        std::atomic<unsigned> next{0};
+
+        auto work{[&] {
+            Chain chain{stages};
+
+            for (auto band{next++}; band < 3 * bands; band = next++)
+            {
+                auto c{band % 3};
+                auto y_begin{static_cast<int>(band / 3) * height};
+
+                chain.run(src_planes[c], m.get_stride(), dst_planes[c], dst.get_stride(), x_size, y_size, y_begin, std::min(y_begin + height, y_size));
+            }
+        }};
+
+        if (threads <= 1 || bands * 3 <= 1)
+        {
+            work();
+            return;
+        }
+
+        std::vector<std::thread> workers{};
+
+        for (auto i{0u}; i < std::min(threads, 3 * bands); i++)
+        {
+            workers.emplace_back([&, i] {
+                Parallel::pin(i);
+                work();
+            });
+        }
+
+        for (auto &worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+}
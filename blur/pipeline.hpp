@@ -0,0 +1,98 @@
+/*
+Author: David Holmqvist <daae19@student.bth.se>
+*/
+
+#include "matrix.hpp"
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#if !defined(PIPELINE_HPP)
+#define PIPELINE_HPP
+
+namespace Filter
+{
+
+    // One step of a Pipeline, applied to each color plane on its own. A
+    // stage sees its input one row at a time, in order, and produces its
+    // output one row at a time, in order; output row y may depend on the
+    // input rows [y - reach(), y + reach()] only. That is what lets a chain
+    // of stages run on line buffers instead of whole intermediate images.
+    class Stage
+    {
+    public:
+        virtual ~Stage() = default;
+
+        // Rows of input above and below an output row that it depends on.
+        virtual int reach() const = 0;
+
+        // A fresh stage with the same parameters, for another worker.
+        virtual std::unique_ptr<Stage> clone() const = 0;
+
+        // Starts on a new x_size by y_size plane, dropping all rows.
+        virtual void start(unsigned x_size, unsigned y_size) = 0;
+
+        // Hands over input row y. Rows arrive consecutively, though not
+        // necessarily from row 0.
+        virtual void push(int y, unsigned char const *row) = 0;
+
+        // Writes output row y. Called in increasing y, once every input row
+        // up to y + reach() (or the last one) has been pushed.
+        virtual void emit(int y, unsigned char *out) = 0;
+    };
+
+    namespace Stages
+    {
+        // The exact engine's Gauss blur; byte-identical to blur().
+        std::unique_ptr<Stage> blur(int radius);
+
+        // Mean over the (2 * radius + 1)^2 square, shrunk at the edges to
+        // the pixels inside the image.
+        std::unique_ptr<Stage> box(int radius);
+
+        // Unsharp mask: in + amount * (in - blur(in, radius)), rounded and
+        // clamped.
+        std::unique_ptr<Stage> unsharp(int radius, double amount);
+
+        // Gradient magnitude of the 3x3 Sobel operator, clamped to 255,
+        // with the edge pixels repeated outwards.
+        std::unique_ptr<Stage> sobel();
+    }
+
+    // A chain of stages run fused: every band of output rows is pulled
+    // through all stages at once, each stage keeping only the rows its
+    // reach needs, so no intermediate image is ever materialized. Bands are
+    // the unit of parallel work; each one recomputes the rows its
+    // neighbours also need, the sum of the reaches of the later stages.
+    class Pipeline
+    {
+    private:
+        std::vector<std::unique_ptr<Stage>> stages;
+
+    public:
+        Pipeline() = default;
+        Pipeline(const Pipeline &other);
+        Pipeline(Pipeline &&other) = default;
+        Pipeline &operator=(Pipeline other);
+
+        Pipeline &add(std::unique_ptr<Stage> stage);
+
+        // Parses a comma separated chain such as "blur:15,unsharp:3:0.5".
+        // Stages are blur:RADIUS, box:RADIUS, unsharp:RADIUS:AMOUNT and
+        // sobel. Reports what is wrong and returns nothing on bad input.
+        static std::optional<Pipeline> parse(const std::string &spec);
+
+        bool empty() const;
+
+        // Total reach of the chain.
+        int reach() const;
+
+        // Runs the chain over m into dst, which keeps its planes when they
+        // are large enough.
+        void run(const Matrix &m, Matrix &dst, const unsigned threads = 1) const;
+    };
+
+}
+
+#endif
@@ -3,147 +3,633 @@ Author: David Holmqvist <daae19@student.bth.se>
 */
 
 #include "ppm.hpp"
-#include <fstream>
+#include "parallel.hpp"
+#include "profile.hpp"
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <immintrin.h>
 #include <iostream>
-#include <regex>
+#include <memory>
 #include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <type_traits>
+#include <unistd.h>
+#include <vector>
 
 namespace PPM {
 
-void Reader::fill(std::string filename)
+namespace {
+
+    // Splits `count` interleaved RGB triples into three planes.
+    void deinterleave_scalar(unsigned char const* in, unsigned char* R, unsigned char* G, unsigned char* B, std::size_t count)
+    {
+        for (std::size_t i { 0 }; i < count; i++) {
+            R[i] = in[3 * i];
+            G[i] = in[3 * i + 1];
+            B[i] = in[3 * i + 2];
+        }
+    }
+
+    // 16 pixels per step: three 16-byte loads, and for every plane one
+    // pshufb per load picking out that plane's bytes, OR'ed together.
+    __attribute__((target("ssse3"))) void deinterleave_ssse3(unsigned char const* in, unsigned char* R, unsigned char* G, unsigned char* B, std::size_t count)
+    {
+        // masks[plane][load]: output byte i of `plane` comes from byte
+        // 3 * i + plane of the 48, if that lies within `load`.
+        alignas(16) static const auto masks { [] {
+            std::array<std::array<std::array<char, 16>, 3>, 3> masks {};
+            for (auto plane { 0 }; plane < 3; plane++) {
+                for (auto load { 0 }; load < 3; load++) {
+                    for (auto i { 0 }; i < 16; i++) {
+                        auto from { 3 * i + plane - 16 * load };
+                        masks[plane][load][i] = from >= 0 && from < 16 ? from : -1;
+                    }
+                }
+            }
+            return masks;
+        }() };
+
+        __m128i shuffles[3][3];
+        for (auto plane { 0 }; plane < 3; plane++) {
+            for (auto load { 0 }; load < 3; load++) {
+                shuffles[plane][load] = _mm_load_si128(reinterpret_cast<__m128i const*>(masks[plane][load].data()));
+            }
+        }
+
+        unsigned char* planes[3] { R, G, B };
+        std::size_t i { 0 };
+
+        for (; i + 16 <= count; i += 16) {
+            __m128i loads[3] {
+                _mm_loadu_si128(reinterpret_cast<__m128i const*>(in + 3 * i)),
+                _mm_loadu_si128(reinterpret_cast<__m128i const*>(in + 3 * i + 16)),
+                _mm_loadu_si128(reinterpret_cast<__m128i const*>(in + 3 * i + 32)),
+            };
+
+            for (auto plane { 0 }; plane < 3; plane++) {
+                auto v { _mm_or_si128(
+                    _mm_or_si128(_mm_shuffle_epi8(loads[0], shuffles[plane][0]), _mm_shuffle_epi8(loads[1], shuffles[plane][1])),
+                    _mm_shuffle_epi8(loads[2], shuffles[plane][2])) };
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(planes[plane] + i), v);
+            }
+        }
+
+        deinterleave_scalar(in + 3 * i, R + i, G + i, B + i, count - i);
+    }
+
+    // Inverse of deinterleave_scalar().
+    void interleave_scalar(unsigned char const* R, unsigned char const* G, unsigned char const* B, unsigned char* out, std::size_t count)
+    {
+        for (std::size_t i { 0 }; i < count; i++) {
+            out[3 * i] = R[i];
+            out[3 * i + 1] = G[i];
+            out[3 * i + 2] = B[i];
+        }
+    }
+
+    // Inverse of deinterleave_ssse3(): three plane loads, and for every
+    // 16-byte output one pshufb per plane, OR'ed together.
+    __attribute__((target("ssse3"))) void interleave_ssse3(unsigned char const* R, unsigned char const* G, unsigned char const* B, unsigned char* out, std::size_t count)
+    {
+        // masks[store][plane]: byte i of output `store` is byte 16 * store + i
+        // of the 48, which is pixel (16 * store + i) / 3 of plane
+        // (16 * store + i) % 3.
+        alignas(16) static const auto masks { [] {
+            std::array<std::array<std::array<char, 16>, 3>, 3> masks {};
+            for (auto store { 0 }; store < 3; store++) {
+                for (auto plane { 0 }; plane < 3; plane++) {
+                    for (auto i { 0 }; i < 16; i++) {
+                        auto j { 16 * store + i };
+                        masks[store][plane][i] = j % 3 == plane ? j / 3 : -1;
+                    }
+                }
+            }
+            return masks;
+        }() };
+
+        __m128i shuffles[3][3];
+        for (auto store { 0 }; store < 3; store++) {
+            for (auto plane { 0 }; plane < 3; plane++) {
+                shuffles[store][plane] = _mm_load_si128(reinterpret_cast<__m128i const*>(masks[store][plane].data()));
+            }
+        }
+
+        std::size_t i { 0 };
+
+        for (; i + 16 <= count; i += 16) {
+            __m128i loads[3] {
+                _mm_loadu_si128(reinterpret_cast<__m128i const*>(R + i)),
+                _mm_loadu_si128(reinterpret_cast<__m128i const*>(G + i)),
+                _mm_loadu_si128(reinterpret_cast<__m128i const*>(B + i)),
+            };
+
+            for (auto store { 0 }; store < 3; store++) {
+                auto v { _mm_or_si128(
+                    _mm_or_si128(_mm_shuffle_epi8(loads[0], shuffles[store][0]), _mm_shuffle_epi8(loads[1], shuffles[store][1])),
+                    _mm_shuffle_epi8(loads[2], shuffles[store][2])) };
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 3 * i + 16 * store), v);
+            }
+        }
+
+        interleave_scalar(R + i, G + i, B + i, out + 3 * i, count - i);
+    }
+
+    void deinterleave(unsigned char const* in, unsigned char* R, unsigned char* G, unsigned char* B, std::size_t count)
+    {
+        static const auto ssse3 { __builtin_cpu_supports("ssse3") != 0 };
+
+        if (ssse3) {
+            deinterleave_ssse3(in, R, G, B, count);
+        } else {
+            deinterleave_scalar(in, R, G, B, count);
+        }
+    }
+
+    void interleave(unsigned char const* R, unsigned char const* G, unsigned char const* B, unsigned char* out, std::size_t count)
+    {
+        static const auto ssse3 { __builtin_cpu_supports("ssse3") != 0 };
+
+        if (ssse3) {
+            interleave_ssse3(R, G, B, out, count);
+        } else {
+            interleave_scalar(R, G, B, out, count);
+        }
+    }
+
+    // `count` pixels of m starting at offset `at` of its planes, from or
+    // to a payload: RGB triples through the SIMD paths above, anything else
+    // one sample at a time, 16-bit ones most significant byte first.
+    template <typename Pixel, unsigned Channels>
+    void unpack(unsigned char const* in, BasicMatrix<Pixel, Channels>& m, std::size_t at, std::size_t count)
+    {
+        if constexpr (std::is_same_v<Pixel, unsigned char> && Channels == 3) {
+            deinterleave(in, m.get_R() + at, m.get_G() + at, m.get_B() + at, count);
+        } else {
+            for (auto c { 0u }; c < Channels; c++) {
+                auto plane { m.get_plane(c) + at };
+
+                for (std::size_t i { 0 }; i < count; i++) {
+                    auto sample { in + (i * Channels + c) * sizeof(Pixel) };
+                    plane[i] = sizeof(Pixel) == 1 ? sample[0] : sample[0] << 8 | sample[1];
+                }
+            }
+        }
+    }
+
+    template <typename Pixel, unsigned Channels>
+    void pack(const BasicMatrix<Pixel, Channels>& m, std::size_t at, unsigned char* out, std::size_t count)
+    {
+        if constexpr (std::is_same_v<Pixel, unsigned char> && Channels == 3) {
+            interleave(m.get_R() + at, m.get_G() + at, m.get_B() + at, out, count);
+        } else {
+            for (auto c { 0u }; c < Channels; c++) {
+                auto plane { m.get_plane(c) + at };
+
+                for (std::size_t i { 0 }; i < count; i++) {
+                    auto sample { out + (i * Channels + c) * sizeof(Pixel) };
+
+                    if constexpr (sizeof(Pixel) == 1) {
+                        sample[0] = plane[i];
+                    } else {
+                        sample[0] = plane[i] >> 8;
+                        sample[1] = plane[i] & 0xff;
+                    }
+                }
+            }
+        }
+    }
+
+    // The pixels [first, first + count) of m in raster order, from or to
+    // a payload, one row at a time unless m's rows are contiguous.
+    template <typename Pixel, unsigned Channels>
+    void deinterleave(unsigned char const* in, BasicMatrix<Pixel, Channels>& m, std::size_t first, std::size_t count)
+    {
+        if (m.is_contiguous()) {
+            unpack(in, m, first, count);
+            return;
+        }
+
+        for (std::size_t done { 0 }; done < count;) {
+            auto y { (first + done) / m.get_x_size() }, x { (first + done) % m.get_x_size() };
+            auto pixels { std::min(count - done, m.get_x_size() - x) };
+
+            unpack(in + Channels * sizeof(Pixel) * done, m, y * m.get_stride() + x, pixels);
+            done += pixels;
+        }
+    }
+
+    template <typename Pixel, unsigned Channels>
+    void interleave(const BasicMatrix<Pixel, Channels>& m, std::size_t first, unsigned char* out, std::size_t count)
+    {
+        if (m.is_contiguous()) {
+            pack(m, first, out, count);
+            return;
+        }
+
+        for (std::size_t done { 0 }; done < count;) {
+            auto y { (first + done) / m.get_x_size() }, x { (first + done) % m.get_x_size() };
+            auto pixels { std::min(count - done, m.get_x_size() - x) };
+
+            pack(m, y * m.get_stride() + x, out + Channels * sizeof(Pixel) * done, pixels);
+            done += pixels;
+        }
+    }
+
+    // pwrite() until all `count` bytes are out, or an error.
+    bool write_all(int fd, unsigned char const* buffer, std::size_t count, off_t offset)
+    {
+        while (count > 0) {
+            auto written { pwrite(fd, buffer, count, offset) };
+
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+
+            buffer += written;
+            count -= written;
+            offset += written;
+        }
+
+        return true;
+    }
+
+    // pread() until all `count` bytes are in; false on an error or if the
+    // file ends first.
+    bool read_all(int fd, unsigned char* buffer, std::size_t count, off_t offset)
+    {
+        while (count > 0) {
+            auto got { pread(fd, buffer, count, offset) };
+
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got <= 0) {
+                return false;
+            }
+
+            buffer += got;
+            count -= got;
+            offset += got;
+        }
+
+        return true;
+    }
+
+    // write() until all `count` bytes are out, or an error. Unlike the
+    // pwrite() form this works on pipes.
+    bool write_all(int fd, unsigned char const* buffer, std::size_t count)
+    {
+        while (count > 0) {
+            auto written { write(fd, buffer, count) };
+
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+
+            buffer += written;
+            count -= written;
+        }
+
+        return true;
+    }
+
+    // Size of the staging buffer each writing thread interleaves into.
+    constexpr std::size_t write_chunk { 1 << 20 };
+
+    // Size of the RowReader and RowWriter buffers.
+    constexpr std::size_t stream_chunk { 1 << 20 };
+
+    // Writes band `index` of `bands` of the payload of m, which starts at
+    // `offset` in fd, in write_chunk sized pieces.
+    template <typename Pixel, unsigned Channels>
+    bool write_rows(int fd, const BasicMatrix<Pixel, Channels>& m, std::size_t offset, unsigned index, unsigned bands)
+    {
+        constexpr std::size_t bytes { Channels * sizeof(Pixel) };
+        auto x_size { m.get_x_size() }, y_size { m.get_y_size() };
+        auto [y_begin, y_end] { Parallel::band(index, bands, y_size) };
+
+        if (y_begin == y_end) {
+            return true;
+        }
+
+        auto rows_per_chunk { std::max<std::size_t>(1, write_chunk / (bytes * std::max(1u, x_size))) };
+
+        std::unique_ptr<unsigned char, decltype(&std::free)> buffer {
+            static_cast<unsigned char*>(std::aligned_alloc(64, (bytes * rows_per_chunk * x_size + 63) / 64 * 64)),
+            &std::free
+        };
+
+        if (!buffer) {
+            return false;
+        }
+
+        for (std::size_t y { y_begin }; y < y_end; y += rows_per_chunk) {
+            auto rows { std::min<std::size_t>(rows_per_chunk, y_end - y) };
+            auto first { y * x_size }, count { rows * x_size };
+
+            interleave(m, first, buffer.get(), count);
+
+            if (!write_all(fd, buffer.get(), bytes * count, offset + bytes * first)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // Walks the header fields of a PPM held in memory. Fields are separated
+    // by whitespace and comments, which run from '#' to the end of the line.
+    class Tokenizer {
+    private:
+        unsigned char const* data;
+        std::size_t size;
+        std::size_t position;
+
+        void skip_whitespace()
+        {
+            while (position < size) {
+                if (data[position] == '#') {
+                    while (position < size && data[position] != '\n') {
+                        position++;
+                    }
+                } else if (std::isspace(data[position])) {
+                    position++;
+                } else {
+                    break;
+                }
+            }
+        }
+
+    public:
+        Tokenizer(unsigned char const* data, std::size_t size)
+            : data { data }
+            , size { size }
+            , position { 0 }
+        {
+        }
+
+        std::string get_magic_number()
+        {
+            auto start { position };
+
+            while (position < size && !std::isspace(data[position])) {
+                position++;
+            }
+
+            return { reinterpret_cast<char const*>(data + start), position - start };
+        }
+
+        // A decimal field, or 0 if there is none or it exceeds max_field.
+        unsigned get_number()
+        {
+            skip_whitespace();
+
+            unsigned long number { 0 };
+            auto start { position };
+
+            while (position < size && std::isdigit(data[position]) && number <= max_field) {
+                number = number * 10 + (data[position++] - '0');
+            }
+
+            if (position == start || number > max_field) {
+                return 0;
+            }
+
+            return number;
+        }
+
+        // Exactly one whitespace character separates the header from the
+        // payload.
+        bool skip_separator()
+        {
+            if (position >= size || !std::isspace(data[position])) {
+                return false;
+            }
+            position++;
+
+            return true;
+        }
+
+        std::size_t get_position() const
+        {
+            return position;
+        }
+    };
+
+}
+
+Header parse_header(unsigned char const* data, std::size_t size)
 {
-    std::ifstream f {};
+    Profile::Scope scope { "parse_header" };
+
+    Tokenizer tokenizer { data, size };
+
+    auto magic { tokenizer.get_magic_number() };
 
-    f.open(filename);
+    if (magic != magic_number && magic != gray_magic_number) {
+        throw std::runtime_error { "incorrect magic number: " + magic };
+    }
+
+    auto x_size { tokenizer.get_number() };
+    auto y_size { tokenizer.get_number() };
 
-    if (!f) {
-        stream.setstate(std::ios::failbit);
-        return;
+    if (x_size == 0 || y_size == 0) {
+        throw std::runtime_error { "couldn't read dimensions" };
     }
 
-    std::copy(
-        std::istreambuf_iterator<char> { f.rdbuf() },
-        std::istreambuf_iterator<char> {},
-        std::ostreambuf_iterator<char> { stream });
+    auto color_max { tokenizer.get_number() };
+
+    if (color_max == 0 || color_max > max_color_max || !tokenizer.skip_separator()) {
+        throw std::runtime_error { "couldn't read color max" };
+    }
 
-    f.close();
+    return { magic == magic_number ? 3u : 1u, x_size, y_size, color_max, tokenizer.get_position() };
 }
 
-std::string Reader::get_magic_number()
+std::size_t sample_bytes(const Header& header)
 {
-    std::string magic {};
+    return header.color_max > 255 ? 2 : 1;
+}
 
-    std::getline(stream, magic);
+void check_format(const Header& header, unsigned channels, std::size_t bytes)
+{
+    if (header.channels != channels || sample_bytes(header) != bytes) {
+        throw std::runtime_error { "expected " + std::string { channels == 3 ? magic_number : gray_magic_number }
+            + " with " + std::to_string(8 * bytes) + "-bit samples, got " + std::to_string(header.channels)
+            + " channel(s) with color max " + std::to_string(header.color_max) };
+    }
+}
+
+Reader::Reader()
+    : data { nullptr }
+    , size { 0 }
+    , position { 0 }
+{
+}
 
-    return magic;
+Reader::~Reader()
+{
+    release();
 }
 
-std::pair<unsigned, unsigned> Reader::get_dimensions()
+bool Reader::fill(std::string filename)
 {
-    std::string line {};
+    Profile::Scope scope { "fill" };
 
-    while (std::getline(stream, line) && line[0] == '#')
-        ;
+    auto fd { open(filename.c_str(), O_RDONLY) };
 
-    std::regex regex { "^(\\d+) (\\d+)$" };
-    std::smatch matches {};
+    if (fd < 0) {
+        return false;
+    }
 
-    std::regex_match(line, matches, regex);
+    struct stat info { };
 
-    if (matches.ready()) {
-        return { std::stoul(matches[1]), std::stoul(matches[2]) };
-    } else {
-        return { 0, 0 };
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        close(fd);
+        return false;
     }
-}
 
-unsigned Reader::get_color_max()
-{
-    std::string line {};
+    auto mapping { mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0) };
+    close(fd);
 
-    std::getline(stream, line);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
 
-    std::regex regex { "^(\\d+)$" };
-    std::smatch matches {};
+    madvise(mapping, info.st_size, MADV_SEQUENTIAL);
 
-    std::regex_match(line, matches, regex);
+    data = static_cast<unsigned char const*>(mapping);
+    size = info.st_size;
+    position = 0;
 
-    if (matches.ready()) {
-        return std::stoul(matches[1]);
-    } else {
-        return 0;
+    return true;
+}
+
+void Reader::release()
+{
+    if (data) {
+        munmap(const_cast<unsigned char*>(data), size);
     }
+
+    data = nullptr;
+    size = position = 0;
 }
 
-std::tuple<unsigned char*, unsigned char*, unsigned char*> Reader::get_data(unsigned x_size, unsigned y_size)
+template <typename Pixel, unsigned Channels>
+bool Reader::get_data(BasicMatrix<Pixel, Channels>& m, unsigned threads)
 {
-    auto size { x_size * y_size };
-    auto R { new char[size] }, G { new char[size] }, B { new char[size] };
+    Profile::Scope scope { "get_data" };
 
-    for (auto i { 0 }, read { 0 }; i < size; i++, read = 0) {
-        stream.read(R + i, 1);
-        read += stream.gcount();
-        stream.read(G + i, 1);
-        read += stream.gcount();
-        stream.read(B + i, 1);
-        read += stream.gcount();
+    constexpr std::size_t bytes { Channels * sizeof(Pixel) };
+    std::size_t count { static_cast<std::size_t>(m.get_x_size()) * m.get_y_size() };
 
-        if (read != 3) {
-            delete[] R;
-            delete[] G;
-            delete[] B;
-            return { nullptr, nullptr, nullptr };
-        }
+    if (size - position < bytes * count) {
+        return false;
+    }
+
+    // Band i of the rows is deinterleaved by worker i, which also owns it
+    // in a parallel blur, so its pages are first touched on that worker's
+    // NUMA node.
+    threads = std::max(1u, std::min(threads, m.get_y_size()));
+    std::vector<std::thread> workers {};
+
+    auto deinterleave_band { [&](unsigned i) {
+        auto [y_begin, y_end] { Parallel::band(i, threads, m.get_y_size()) };
+        std::size_t first { static_cast<std::size_t>(y_begin) * m.get_x_size() };
+        std::size_t pixels { static_cast<std::size_t>(y_end - y_begin) * m.get_x_size() };
+
+        deinterleave(data + position + bytes * first, m, first, pixels);
+    } };
+
+    for (auto i { 1u }; i < threads; i++) {
+        workers.emplace_back([&, i] {
+            Parallel::pin(i);
+            deinterleave_band(i);
+        });
+    }
+    deinterleave_band(0);
+
+    for (auto& worker : workers) {
+        worker.join();
     }
 
-    return { reinterpret_cast<unsigned char*>(R), reinterpret_cast<unsigned char*>(G), reinterpret_cast<unsigned char*>(B) };
+    position += bytes * count;
+
+    return true;
 }
 
 Matrix Reader::operator()(std::string filename)
 {
-    try {
-        fill(filename);
+    Matrix m {};
 
-        if (stream.fail()) {
-            throw std::runtime_error { "couldn't open file " + filename };
-        }
+    if (!(*this)(filename, m)) {
+        return Matrix {};
+    }
 
-        auto magic { get_magic_number() };
+    return m;
+}
 
-        if (magic != magic_number) {
-            throw std::runtime_error { "incorrect magic number: " + magic };
+template <typename Pixel, unsigned Channels>
+bool Reader::operator()(std::string filename, BasicMatrix<Pixel, Channels>& m, unsigned threads)
+{
+    try {
+        if (!fill(filename)) {
+            throw std::runtime_error { "couldn't open file " + filename };
         }
 
-        auto [x_size, y_size] { get_dimensions() };
+        auto header { parse_header(data, size) };
+        check_format(header, Channels, sizeof(Pixel));
 
-        if (x_size == 0 || y_size == 0) {
-            throw std::runtime_error { "couldn't read dimensions" };
-        }
-
-        auto total_size { x_size * y_size };
+        auto [channels, x_size, y_size, color_max, payload] { header };
+        auto total_size { static_cast<std::size_t>(x_size) * y_size };
 
         if (total_size > max_pixels) {
             throw std::runtime_error { "image size is too big: " + std::to_string(total_size) };
         }
 
-        auto color_max { get_color_max() };
+        position = payload;
+        m.resize(x_size, y_size);
+        m.set_color_max(color_max);
 
-        if (color_max == 0) {
-            throw std::runtime_error { "couldn't read color max" };
+        if (!get_data(m, threads)) {
+            throw std::runtime_error { "couldn't read image data" };
         }
 
-        auto [R, G, B] { get_data(x_size, y_size) };
+        release();
+        return true;
+    } catch (std::runtime_error e) {
+        error("reading", e.what());
+        release();
+        return false;
+    }
+}
 
-        if (!R || !G || !B) {
-            throw std::runtime_error { "couldn't read image data" };
+std::optional<Header> Reader::probe(std::string filename)
+{
+    try {
+        if (!fill(filename)) {
+            throw std::runtime_error { "couldn't open file " + filename };
         }
 
-        stream.clear();
-        return Matrix { R, G, B, x_size, y_size, color_max };
-    } catch (std::runtime_error e) {
+        auto header { parse_header(data, size) };
+        release();
+        return header;
+    } catch (const std::runtime_error& e) {
         error("reading", e.what());
-        stream.clear();
-        return Matrix {};
+        release();
+        return std::nullopt;
     }
 }
 
@@ -152,36 +638,474 @@ void error(std::string op, std::string what)
     std::cerr << "Encountered PPM error during " << op << ": " << what << std::endl;
 }
 
-void Writer::operator()(Matrix m, std::string filename)
+template <typename Pixel, unsigned Channels>
+bool Writer::operator()(const BasicMatrix<Pixel, Channels>& m, std::string filename, unsigned threads)
 {
+    Profile::Scope scope { "write" };
+
     try {
-        std::ofstream f {};
+        if ((m.get_color_max() > 255) != (sizeof(Pixel) == 2)) {
+            throw std::runtime_error { "color max " + std::to_string(m.get_color_max()) + " does not match "
+                + std::to_string(8 * sizeof(Pixel)) + "-bit samples" };
+        }
 
-        f.open(filename);
+        auto fd { open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644) };
 
-        if (!f) {
+        if (fd < 0) {
             throw std::runtime_error { "failed to open " + filename };
         }
 
-        f << magic_number << std::endl;
+        auto header { std::string { Channels == 3 ? magic_number : gray_magic_number } + "\n"
+            + std::to_string(m.get_x_size()) + " " + std::to_string(m.get_y_size()) + "\n"
+            + std::to_string(m.get_color_max()) + "\n" };
+
+        auto ok { write_all(fd, reinterpret_cast<unsigned char const*>(header.data()), header.size(), 0) };
+
+        // Every thread interleaves and writes its own band of rows at the
+        // band's offset in the file, so no thread waits on another.
+        threads = std::max(1u, std::min(threads, m.get_y_size()));
+        std::vector<std::thread> workers {};
+        std::vector<char> band_ok(threads, 1);
 
-        f << m.get_x_size() << " " << m.get_y_size() << std::endl;
-        f << m.get_color_max() << std::endl;
+        for (auto i { 1u }; i < threads; i++) {
+            workers.emplace_back([&, i] {
+                Parallel::pin(i);
+                band_ok[i] = write_rows(fd, m, header.size(), i, threads);
+            });
+        }
+        band_ok[0] = write_rows(fd, m, header.size(), 0, threads);
+
+        for (auto& worker : workers) {
+            worker.join();
+        }
 
-        auto size { m.get_x_size() * m.get_y_size() };
-        auto R { m.get_R() }, G { m.get_G() }, B { m.get_B() };
-        auto it_R { R }, it_G { G }, it_B { B };
+        close(fd);
 
-        while (it_R < R + size && it_G < G + size && it_B < B + size) {
-            f << *it_R++
-              << *it_G++
-              << *it_B++;
+        if (!ok || std::find(band_ok.begin(), band_ok.end(), 0) != band_ok.end()) {
+            throw std::runtime_error { "failed to write " + filename };
         }
 
-        f.close();
+        return true;
     } catch (std::runtime_error e) {
         error("writing", e.what());
+        return false;
+    }
+}
+
+template bool Reader::operator()(std::string, Matrix&, unsigned);
+template bool Reader::operator()(std::string, GrayMatrix&, unsigned);
+template bool Reader::operator()(std::string, Matrix16&, unsigned);
+template bool Reader::operator()(std::string, GrayMatrix16&, unsigned);
+
+template bool Writer::operator()(const Matrix&, std::string, unsigned);
+template bool Writer::operator()(const GrayMatrix&, std::string, unsigned);
+template bool Writer::operator()(const Matrix16&, std::string, unsigned);
+template bool Writer::operator()(const GrayMatrix16&, std::string, unsigned);
+
+StripReader::StripReader()
+    : fd { -1 }
+    , header {}
+{
+}
+
+StripReader::~StripReader()
+{
+    if (fd >= 0) {
+        ::close(fd);
     }
 }
 
+bool StripReader::open(std::string filename)
+{
+    try {
+        fd = ::open(filename.c_str(), O_RDONLY);
+
+        if (fd < 0) {
+            throw std::runtime_error { "couldn't open file " + filename };
+        }
+
+        // As in RowReader, the header has to fit in the first chunk.
+        buffer.resize(stream_chunk);
+
+        auto got { pread(fd, buffer.data(), buffer.size(), 0) };
+
+        if (got <= 0) {
+            throw std::runtime_error { "couldn't read header" };
+        }
+
+        header = parse_header(buffer.data(), got);
+        check_format(header, 3, 1);
+        return true;
+    } catch (const std::runtime_error& e) {
+        error("reading", e.what());
+        return false;
+    }
+}
+
+unsigned StripReader::get_x_size() const
+{
+    return header.x_size;
+}
+
+unsigned StripReader::get_y_size() const
+{
+    return header.y_size;
+}
+
+unsigned StripReader::get_color_max() const
+{
+    return header.color_max;
+}
+
+bool StripReader::operator()(unsigned y_begin, unsigned y_end, Matrix& m)
+{
+    try {
+        y_end = std::min(y_end, header.y_size);
+
+        if (y_begin >= y_end) {
+            throw std::runtime_error { "empty strip" };
+        }
+
+        auto count { static_cast<std::size_t>(header.x_size) * (y_end - y_begin) };
+
+        if (count > max_pixels) {
+            throw std::runtime_error { "strip size is too big: " + std::to_string(count) };
+        }
+
+        buffer.resize(3 * count);
+
+        if (!read_all(fd, buffer.data(), 3 * count, header.payload + 3 * static_cast<std::size_t>(header.x_size) * y_begin)) {
+            throw std::runtime_error { "couldn't read image data" };
+        }
+
+        m.resize(header.x_size, y_end - y_begin);
+        m.set_color_max(header.color_max);
+        deinterleave(buffer.data(), m, 0, count);
+
+        return true;
+    } catch (const std::runtime_error& e) {
+        error("reading", e.what());
+        return false;
+    }
+}
+
+RowReader::RowReader()
+    : fd { -1 }
+    , header {}
+    , buffer(stream_chunk)
+    , position { 0 }
+    , filled { 0 }
+{
+}
+
+RowReader::~RowReader()
+{
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+// Moves the unread bytes to the front and reads until the buffer is full or
+// the file ends; false only on a read error.
+bool RowReader::refill()
+{
+    std::copy(buffer.begin() + position, buffer.begin() + filled, buffer.begin());
+    filled -= position;
+    position = 0;
+
+    while (filled < buffer.size()) {
+        auto count { read(fd, buffer.data() + filled, buffer.size() - filled) };
+
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count < 0) {
+            return false;
+        }
+        if (count == 0) {
+            break;
+        }
+
+        filled += count;
+    }
+
+    return true;
+}
+
+bool RowReader::open(std::string filename)
+{
+    try {
+        fd = ::open(filename.c_str(), O_RDONLY);
+
+        if (fd < 0) {
+            throw std::runtime_error { "couldn't open file " + filename };
+        }
+
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+        // The header is assumed to fit in the first chunk, which only a
+        // megabyte of comments would break.
+        if (!refill() || filled == 0) {
+            throw std::runtime_error { "couldn't read file " + filename };
+        }
+
+        header = parse_header(buffer.data(), filled);
+        check_format(header, 3, 1);
+        position = header.payload;
+
+        // One row must fit in the buffer next to the partial one before it.
+        auto row { 3 * static_cast<std::size_t>(header.x_size) };
+        if (buffer.size() < 2 * row) {
+            buffer.resize(2 * row);
+        }
+
+        return true;
+    } catch (const std::runtime_error& e) {
+        error("reading", e.what());
+        return false;
+    }
+}
+
+unsigned RowReader::get_x_size() const
+{
+    return header.x_size;
+}
+
+unsigned RowReader::get_y_size() const
+{
+    return header.y_size;
+}
+
+unsigned RowReader::get_color_max() const
+{
+    return header.color_max;
+}
+
+bool RowReader::read_row(unsigned char* R, unsigned char* G, unsigned char* B)
+{
+    auto row { 3 * static_cast<std::size_t>(header.x_size) };
+
+    if (filled - position < row) {
+        if (!refill() || filled - position < row) {
+            error("reading", "couldn't read image data");
+            return false;
+        }
+    }
+
+    deinterleave(buffer.data() + position, R, G, B, header.x_size);
+    position += row;
+
+    return true;
+}
+
+RowWriter::RowWriter()
+    : fd { -1 }
+    , filename {}
+    , buffer(stream_chunk)
+    , filled { 0 }
+    , failed { false }
+{
+}
+
+RowWriter::~RowWriter()
+{
+    if (fd >= 0) {
+        close();
+    }
+}
+
+void RowWriter::flush()
+{
+    if (!failed && !write_all(fd, buffer.data(), filled)) {
+        failed = true;
+    }
+
+    filled = 0;
+}
+
+bool RowWriter::open(std::string filename, unsigned x_size, unsigned y_size, unsigned color_max)
+{
+    this->filename = filename;
+    fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0) {
+        error("writing", "failed to open " + filename);
+        return false;
+    }
+
+    auto header { std::string { magic_number } + "\n"
+        + std::to_string(x_size) + " " + std::to_string(y_size) + "\n"
+        + std::to_string(color_max) + "\n" };
+
+    std::copy(header.begin(), header.end(), buffer.begin());
+    filled = header.size();
+
+    auto row { 3 * static_cast<std::size_t>(x_size) };
+    if (buffer.size() < row) {
+        buffer.resize(row);
+    }
+
+    return true;
+}
+
+void RowWriter::write_row(unsigned char const* R, unsigned char const* G, unsigned char const* B, unsigned x_size)
+{
+    auto row { 3 * static_cast<std::size_t>(x_size) };
+
+    if (buffer.size() - filled < row) {
+        flush();
+    }
+
+    interleave(R, G, B, buffer.data() + filled, x_size);
+    filled += row;
+}
+
+bool RowWriter::close()
+{
+    flush();
+    ::close(fd);
+    fd = -1;
+
+    if (failed) {
+        error("writing", "failed to write " + filename);
+    }
+
+    return !failed;
+}
+
+FrameReader::FrameReader(int fd)
+    : fd { fd }
+    , buffer(stream_chunk)
+    , position { 0 }
+    , filled { 0 }
+    , end { false }
+    , error_seen { false }
+{
+}
+
+bool FrameReader::fill(std::size_t count)
+{
+    if (filled - position >= count) {
+        return true;
+    }
+
+    std::copy(buffer.begin() + position, buffer.begin() + filled, buffer.begin());
+    filled -= position;
+    position = 0;
+
+    if (buffer.size() < count) {
+        buffer.resize(count);
+    }
+
+    while (filled < count && !end) {
+        auto read_count { read(fd, buffer.data() + filled, buffer.size() - filled) };
+
+        if (read_count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (read_count <= 0) {
+            end = true;
+            break;
+        }
+
+        filled += read_count;
+    }
+
+    return filled >= count;
+}
+
+bool FrameReader::operator()(Matrix& m)
+{
+    try {
+        // Only the separator after the color max makes a header complete, so
+        // keep reading until parse_header() accepts what has arrived.
+        // Headers are small; give up once a whole chunk has not been enough.
+        Header header {};
+
+        while (true) {
+            try {
+                header = parse_header(buffer.data() + position, filled - position);
+                break;
+            } catch (const std::runtime_error& e) {
+                if (filled - position >= stream_chunk) {
+                    throw;
+                }
+                if (!fill(filled - position + 1)) {
+                    if (filled == position) {
+                        return false;
+                    }
+                    throw;
+                }
+            }
+        }
+
+        check_format(header, 3, 1);
+
+        std::size_t count { static_cast<std::size_t>(header.x_size) * header.y_size };
+
+        if (count > max_pixels) {
+            throw std::runtime_error { "image size is too big: " + std::to_string(count) };
+        }
+
+        position += header.payload;
+        m.resize(header.x_size, header.y_size);
+        m.set_color_max(header.color_max);
+
+        // Deinterleave whatever whole pixels have arrived, a chunk at a
+        // time.
+        for (std::size_t done { 0 }; done < count;) {
+            auto pixels { std::min(count - done, stream_chunk / 3) };
+
+            if (!fill(3 * pixels)) {
+                throw std::runtime_error { "couldn't read image data" };
+            }
+
+            deinterleave(buffer.data() + position, m, done, pixels);
+            position += 3 * pixels;
+            done += pixels;
+        }
+
+        return true;
+    } catch (const std::runtime_error& e) {
+        error("reading", e.what());
+        error_seen = true;
+        return false;
+    }
+}
+
+bool FrameReader::failed() const
+{
+    return error_seen;
+}
+
+FrameWriter::FrameWriter(int fd)
+    : fd { fd }
+    , buffer(stream_chunk)
+{
+}
+
+bool FrameWriter::operator()(const Matrix& m)
+{
+    auto header { std::string { magic_number } + "\n"
+        + std::to_string(m.get_x_size()) + " " + std::to_string(m.get_y_size()) + "\n"
+        + std::to_string(m.get_color_max()) + "\n" };
+
+    auto ok { write_all(fd, reinterpret_cast<unsigned char const*>(header.data()), header.size()) };
+    std::size_t count { static_cast<std::size_t>(m.get_x_size()) * m.get_y_size() };
+
+    for (std::size_t done { 0 }; ok && done < count;) {
+        auto pixels { std::min(count - done, stream_chunk / 3) };
+
+        interleave(m, done, buffer.data(), pixels);
+        ok = write_all(fd, buffer.data(), 3 * pixels);
+        done += pixels;
+    }
+
+    if (!ok) {
+        error("writing", "failed to write frame");
+    }
+
+    return ok;
+}
+
 }
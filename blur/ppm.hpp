@@ -5,7 +5,10 @@ Author: David Holmqvist <daae19@student.bth.se>
 #include "matrix.hpp"
 #include <exception>
 #include <iostream>
-#include <sstream>
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <vector>
 
 #if !defined(PPM_READER_HPP)
 #define PPM_READER_HPP
@@ -17,24 +20,206 @@ void error(std::string op, std::string what);
 constexpr unsigned max_dimension { 3000 };
 constexpr unsigned max_pixels { max_dimension * max_dimension };
 constexpr char const* magic_number { "P6" };
+constexpr char const* gray_magic_number { "P5" };
 
+// Largest color max; above 255 every sample takes two bytes, most
+// significant first.
+constexpr unsigned max_color_max { 65535 };
+
+// Largest value accepted for any numeric header field. Reader still caps
+// whole images at max_pixels; only the row streaming classes go beyond.
+constexpr unsigned max_field { 1 << 20 };
+
+// The header fields of a P5 (grey, one channel) or P6 (RGB, three
+// channels) file and the offset its payload starts at.
+struct Header {
+    unsigned channels;
+    unsigned x_size;
+    unsigned y_size;
+    unsigned color_max;
+    std::size_t payload;
+};
+
+// Parses the header at the start of data[0, size), throwing
+// std::runtime_error naming the first field that is missing or malformed.
+Header parse_header(unsigned char const* data, std::size_t size);
+
+// Bytes per sample of the images header describes, 1 or 2.
+std::size_t sample_bytes(const Header& header);
+
+// Throws std::runtime_error unless header describes images of `channels`
+// channels of `bytes` bytes per sample.
+void check_format(const Header& header, unsigned channels, std::size_t bytes);
+
+// Maps the whole file read-only and parses it in place: the header with a
+// small hand-written tokenizer, the payload by splitting the interleaved
+// samples straight from the mapping into the planes.
 class Reader {
 private:
-    std::stringstream stream;
+    unsigned char const* data;
+    std::size_t size;
+    std::size_t position;
 
-    std::string get_magic_number();
-    std::pair<unsigned, unsigned> get_dimensions();
-    std::tuple<unsigned char*, unsigned char*, unsigned char*> get_data(unsigned x_size, unsigned y_size);
-    unsigned get_color_max();
-    void fill(std::string filename);
+    template <typename Pixel, unsigned Channels>
+    bool get_data(BasicMatrix<Pixel, Channels>& m, unsigned threads);
+    bool fill(std::string filename);
+    void release();
 
 public:
+    Reader();
+    Reader(const Reader&) = delete;
+    Reader& operator=(const Reader&) = delete;
+    ~Reader();
+
     Matrix operator()(std::string filename);
+
+    // Reads into m, reusing its planes when they are large enough, with the
+    // rows split into `threads` bands deinterleaved concurrently. The file
+    // has to be P6 for three channels and P5 for one, with a color max
+    // above 255 exactly for 16-bit samples. Reports and returns false on
+    // failure, leaving the contents of m unspecified.
+    template <typename Pixel, unsigned Channels>
+    bool operator()(std::string filename, BasicMatrix<Pixel, Channels>& m, unsigned threads = 1);
+
+    // The header of filename, without reading the payload; reports and
+    // returns nothing on failure.
+    std::optional<Header> probe(std::string filename);
 };
 
+// Interleaves the planes into a staging buffer a chunk of rows at a time and
+// hands each chunk to the kernel in one pwrite().
 class Writer {
 public:
-    void operator()(Matrix m, std::string filename);
+    // Writes P6 for three channels and P5 for one, splitting the rows into
+    // `threads` bands that are interleaved and written concurrently, each at
+    // its own offset in the file. Reports and returns false on failure.
+    template <typename Pixel, unsigned Channels>
+    bool operator()(const BasicMatrix<Pixel, Channels>& m, std::string filename, unsigned threads = 1);
+};
+
+// Reads a P6 file one row at a time through a fixed-size buffer, for
+// images too large to hold in memory. Not bound by max_pixels.
+class RowReader {
+private:
+    int fd;
+    Header header;
+    std::vector<unsigned char> buffer;
+    std::size_t position;
+    std::size_t filled;
+
+    bool refill();
+
+public:
+    RowReader();
+    RowReader(const RowReader&) = delete;
+    RowReader& operator=(const RowReader&) = delete;
+    ~RowReader();
+
+    // Opens filename and parses its header; reports and returns false on
+    // failure.
+    bool open(std::string filename);
+
+    unsigned get_x_size() const;
+    unsigned get_y_size() const;
+    unsigned get_color_max() const;
+
+    // Reads the next row into three get_x_size() long planes.
+    bool read_row(unsigned char* R, unsigned char* G, unsigned char* B);
+};
+
+// Reads horizontal strips of a P6 file, each with one positioned read of
+// just its rows, for shards of images too large to read whole. Only a strip
+// is bound by max_pixels.
+class StripReader {
+private:
+    int fd;
+    Header header;
+    std::vector<unsigned char> buffer;
+
+public:
+    StripReader();
+    StripReader(const StripReader&) = delete;
+    StripReader& operator=(const StripReader&) = delete;
+    ~StripReader();
+
+    // Opens filename and parses its header; reports and returns false on
+    // failure.
+    bool open(std::string filename);
+
+    unsigned get_x_size() const;
+    unsigned get_y_size() const;
+    unsigned get_color_max() const;
+
+    // Reads the rows [y_begin, y_end) into m, reusing its planes when they
+    // are large enough. Reports and returns false on failure.
+    bool operator()(unsigned y_begin, unsigned y_end, Matrix& m);
+};
+
+// Writes a P6 file one row at a time, interleaving into a buffer that is
+// flushed in large write() calls.
+class RowWriter {
+private:
+    int fd;
+    std::string filename;
+    std::vector<unsigned char> buffer;
+    std::size_t filled;
+    bool failed;
+
+    void flush();
+
+public:
+    RowWriter();
+    RowWriter(const RowWriter&) = delete;
+    RowWriter& operator=(const RowWriter&) = delete;
+    ~RowWriter();
+
+    // Creates filename and writes the header; reports and returns false on
+    // failure.
+    bool open(std::string filename, unsigned x_size, unsigned y_size, unsigned color_max);
+
+    void write_row(unsigned char const* R, unsigned char const* G, unsigned char const* B, unsigned x_size);
+
+    // Flushes and closes; reports and returns false if any write failed.
+    bool close();
+};
+
+// Reads concatenated P6 frames from a descriptor such as a pipe on stdin,
+// one per call, without knowing where the stream ends beforehand.
+class FrameReader {
+private:
+    int fd;
+    std::vector<unsigned char> buffer;
+    std::size_t position;
+    std::size_t filled;
+    bool end;
+    bool error_seen;
+
+    bool fill(std::size_t count);
+
+public:
+    FrameReader(int fd);
+
+    // Reads the next frame into m, reusing its planes when they are large
+    // enough. Returns false at the end of the stream, or after reporting a
+    // malformed or truncated frame.
+    bool operator()(Matrix& m);
+
+    // Whether the last false from operator() was an error rather than the
+    // end of the stream.
+    bool failed() const;
+};
+
+// Writes P6 frames back to back to a descriptor such as stdout.
+class FrameWriter {
+private:
+    int fd;
+    std::vector<unsigned char> buffer;
+
+public:
+    FrameWriter(int fd);
+
+    // Reports and returns false on failure.
+    bool operator()(const Matrix& m);
 };
 
 }
@@ -0,0 +1,185 @@
+/*
+Author: David Holmqvist <daae19@student.bth.se>
+*/
+
+#include "profile.hpp"
+
+#if defined(BLUR_PROFILE)
+
+#include <algorithm>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <mutex>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace Profile
+{
+
+    namespace
+    {
+        constexpr char const *counter_names[4]{"cycles", "instructions", "llc_misses", "dtlb_misses"};
+
+        struct Totals
+        {
+            std::uint64_t calls{0};
+            double seconds{0};
+            std::uint64_t counters[4]{0, 0, 0, 0};
+            bool counted{true};
+        };
+
+        std::mutex mutex{};
+        std::vector<std::pair<std::string, Totals>> phases{};
+
+        // One counter group per thread, opened on its first Scope: the
+        // counters only count the thread that opened them, and they run
+        // from then on, so a Scope reads them at either end.
+        class Counters
+        {
+        private:
+            int fds[4];
+
+            static int open(std::uint32_t type, std::uint64_t config, int group)
+            {
+                perf_event_attr attr{};
+                std::memset(&attr, 0, sizeof(attr));
+                attr.size = sizeof(attr);
+                attr.type = type;
+                attr.config = config;
+                attr.read_format = PERF_FORMAT_GROUP;
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+
+                return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, group, 0));
+            }
+
+            static constexpr std::uint64_t cache_miss(std::uint64_t cache)
+            {
+                return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            }
+
+        public:
+            bool ok;
+
+            Counters()
+                : fds{-1, -1, -1, -1}, ok{false}
+            {
+                fds[0] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1);
+                fds[1] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, fds[0]);
+                fds[2] = open(PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_LL), fds[0]);
+                fds[3] = open(PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_DTLB), fds[0]);
+
+                ok = fds[0] >= 0 && fds[1] >= 0 && fds[2] >= 0 && fds[3] >= 0;
+
+                if (ok)
+                {
+                    ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+                    ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+                }
+            }
+
+            ~Counters()
+            {
+                for (auto fd : fds)
+                {
+                    if (fd >= 0)
+                    {
+                        close(fd);
+                    }
+                }
+            }
+
+            bool read(std::uint64_t (&values)[4])
+            {
+                std::uint64_t group[5]{};
+
+                if (!ok || ::read(fds[0], group, sizeof(group)) != static_cast<ssize_t>(sizeof(group)) || group[0] != 4)
+                {
+                    return false;
+                }
+
+                std::copy(group + 1, group + 5, values);
+                return true;
+            }
+        };
+
+        Counters &counters()
+        {
+            thread_local Counters counters{};
+            return counters;
+        }
+    }
+
+    Scope::Scope(char const *phase)
+        : phase{phase}, start{}, counters{0, 0, 0, 0}, counting{Profile::counters().read(counters)}
+    {
+        start = std::chrono::steady_clock::now();
+    }
+
+    Scope::~Scope()
+    {
+        auto seconds{std::chrono::duration<double>{std::chrono::steady_clock::now() - start}.count()};
+        std::uint64_t end[4]{};
+        auto counted{counting && Profile::counters().read(end)};
+
+        std::lock_guard<std::mutex> lock{mutex};
+
+        auto totals{std::find_if(phases.begin(), phases.end(), [&](auto &entry) { return entry.first == phase; })};
+
+        if (totals == phases.end())
+        {
+            totals = phases.insert(phases.end(), {phase, Totals{}});
+        }
+
+        auto &[name, t]{*totals};
+        t.calls++;
+        t.seconds += seconds;
+        t.counted = t.counted && counted;
+
+        for (auto i{0}; i < 4 && counted; i++)
+        {
+            t.counters[i] += end[i] - counters[i];
+        }
+    }
+
+    void report(std::ostream &out)
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+
+        auto counted{std::all_of(phases.begin(), phases.end(), [](auto &entry) { return entry.second.counted; })};
+
+        out << "{\"counters\": " << (counted ? "true" : "false") << ", \"phases\": {";
+
+        for (std::size_t p{0}; p < phases.size(); p++)
+        {
+            auto &[name, t]{phases[p]};
+
+            out << (p > 0 ? ", " : "") << "\"" << name << "\": {\"calls\": " << t.calls << ", \"seconds\": " << t.seconds;
+
+            if (t.counted)
+            {
+                for (auto i{0}; i < 4; i++)
+                {
+                    out << ", \"" << counter_names[i] << "\": " << t.counters[i];
+                }
+
+                auto cycles{static_cast<double>(t.counters[0])}, instructions{static_cast<double>(t.counters[1])};
+
+                out << ", \"ipc\": " << (cycles > 0 ? instructions / cycles : 0.0)
+                    << ", \"llc_mpki\": " << (instructions > 0 ? 1000 * t.counters[2] / instructions : 0.0)
+                    << ", \"dtlb_mpki\": " << (instructions > 0 ? 1000 * t.counters[3] / instructions : 0.0);
+            }
+
+            out << "}";
+        }
+
+        out << "}}" << std::endl;
+    }
+
+}
+
+#endif
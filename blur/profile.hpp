@@ -0,0 +1,67 @@
+/*
+Author: David Holmqvist <daae19@student.bth.se>
+*/
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+#if !defined(PROFILE_HPP)
+#define PROFILE_HPP
+
+// Per-phase timers and hardware counters, compiled in only when
+// BLUR_PROFILE is defined (make PROFILE=1); otherwise a Scope is an empty
+// object and report() does nothing, so the hot paths carry no cost.
+//
+// A Scope accumulates the wall time of its lifetime into the totals of its
+// phase, together with the cycles, instructions, last-level cache misses
+// and dTLB misses its thread spent in that time, counted with
+// perf_event_open(2) when the kernel allows it. Phases run by several
+// workers add up their threads, so their time is thread-seconds. Scopes
+// may nest; each counts everything inside it.
+namespace Profile
+{
+
+#if defined(BLUR_PROFILE)
+
+    class Scope
+    {
+    private:
+        char const *phase;
+        std::chrono::steady_clock::time_point start;
+        std::uint64_t counters[4];
+        bool counting;
+
+    public:
+        Scope(char const *phase);
+        ~Scope();
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+    };
+
+    // Writes every phase seen so far as one JSON object: calls, seconds
+    // and, when counted, the counters with instructions per cycle and
+    // misses per thousand instructions. "counters" is false when
+    // perf_event_open was refused, e.g. by kernel.perf_event_paranoid.
+    void report(std::ostream &out);
+
+#else
+
+    class Scope
+    {
+    public:
+        Scope(char const *)
+        {
+        }
+    };
+
+    inline void report(std::ostream &)
+    {
+    }
+
+#endif
+
+}
+
+#endif
@@ -0,0 +1,103 @@
+/*
+Author: David Holmqvist <daae19@student.bth.se>
+*/
+
+#include "matrix.hpp"
+#include "ppm.hpp"
+#include "filters.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Blurs each image with the exact engine and with another one for a list of
+// radii and prints how far apart the two are, one line per radius and image.
+
+namespace {
+
+void usage(char const* program)
+{
+    std::cerr << "Usage: " << program << " [--engine=NAME] [radius,...] [infile...]" << std::endl
+              << "  --engine=NAME           engine to compare against exact, pyramid by default" << std::endl;
+    std::exit(1);
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double> { std::chrono::steady_clock::now() - start }.count();
+}
+
+}
+
+int main(int argc, char const* argv[])
+{
+    auto engine { Filter::Engine::pyramid };
+    std::string name { "pyramid" };
+    auto arg { 1 };
+
+    if (arg < argc && std::string { argv[arg] }.rfind("--engine=", 0) == 0) {
+        name = std::string { argv[arg] }.substr(std::string { "--engine=" }.size());
+        auto selected { Filter::engine_from_name(name) };
+
+        if (!selected) {
+            std::cerr << "Unknown engine: " << name << std::endl;
+            usage(argv[0]);
+        }
+
+        engine = *selected;
+        arg++;
+    }
+
+    if (argc - arg < 2) {
+        usage(argv[0]);
+    }
+
+    std::vector<int> radii {};
+    std::istringstream list { argv[arg++] };
+
+    for (std::string item; std::getline(list, item, ',');) {
+        auto radius { std::atoi(item.c_str()) };
+
+        if (radius < 1 || radius > static_cast<int>(Filter::Gauss::max_radius)) {
+            std::cerr << "Radius must be between 1 and " << Filter::Gauss::max_radius << ": " << item << std::endl;
+            usage(argv[0]);
+        }
+
+        radii.push_back(radius);
+    }
+
+    PPM::Reader reader {};
+    Filter::Workspace workspace {};
+    Matrix m {};
+    Matrix reference {};
+    Matrix blurred {};
+    auto failed { 0 };
+
+    std::cout << "image radius engine psnr max mean exact_s engine_s" << std::endl;
+
+    for (; arg < argc; arg++) {
+        if (!reader(argv[arg], m)) {
+            failed++;
+            continue;
+        }
+
+        for (auto radius : radii) {
+            auto start { std::chrono::steady_clock::now() };
+            Filter::blur(m, reference, radius, Filter::Engine::exact, workspace);
+            auto exact_seconds { seconds_since(start) };
+
+            start = std::chrono::steady_clock::now();
+            Filter::blur(m, blurred, radius, engine, workspace);
+            auto engine_seconds { seconds_since(start) };
+
+            auto difference { Filter::compare(blurred, reference) };
+
+            std::cout << argv[arg] << " " << radius << " " << name << " " << difference.psnr << " "
+                      << difference.max << " " << difference.mean << " " << exact_seconds << " " << engine_seconds << std::endl;
+        }
+    }
+
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,198 @@
+/*
+Author: David Holmqvist <daae19@student.bth.se>
+*/
+
+#include "pyramid.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+namespace Filter
+{
+
+    namespace Pyramid
+    {
+        namespace
+        {
+            // Sigma of the kernel Gauss::get_weights() builds for a radius,
+            // exp(-(i * max_x / radius)^2 * pi) = exp(-i^2 / (2 sigma^2)).
+            double sigma(double radius)
+            {
+                return radius / (Gauss::max_x * std::sqrt(2.0 * Gauss::pi));
+            }
+
+            // Radius of the coarse blur after `levels` halvings, in coarse
+            // pixels. Averaging pairs of level i pixels adds a variance of
+            // 4^i / 4 full-size pixels, and interpolating up from a 2^levels
+            // grid one of 4^levels / 6 (a triangle that wide).
+            double coarse_radius(int radius, int levels)
+            {
+                auto scale{std::ldexp(1.0, levels)};
+                auto added{(scale * scale - 1) / 12 + scale * scale / 6};
+                auto remaining{sigma(radius) * sigma(radius) - added};
+
+                return remaining > 0 ? std::sqrt(remaining) / scale / sigma(1.0) : 0.0;
+            }
+
+            // dst = src halved in both directions, a trailing odd row or
+            // column averaged with itself.
+            void halve(const Matrix &src, Matrix &dst)
+            {
+                auto x_size{src.get_x_size()}, y_size{src.get_y_size()};
+                auto half_x{(x_size + 1) / 2}, half_y{(y_size + 1) / 2};
+
+                dst.resize(half_x, half_y);
+                dst.set_color_max(src.get_color_max());
+
+                unsigned char const *in[3]{src.get_R(), src.get_G(), src.get_B()};
+                unsigned char *out[3]{dst.get_R(), dst.get_G(), dst.get_B()};
+
+                for (auto c{0}; c < 3; c++)
+                {
+                    for (auto y{0u}; y < half_y; y++)
+                    {
+                        auto top{in[c] + 2 * y * src.get_stride()};
+                        auto bottom{in[c] + std::min(2 * y + 1, y_size - 1) * src.get_stride()};
+
+                        for (auto x{0u}; x < half_x; x++)
+                        {
+                            auto left{2 * x}, right{std::min(2 * x + 1, x_size - 1)};
+                            out[c][y * dst.get_stride() + x] = (top[left] + top[right] + bottom[left] + bottom[right] + 2) / 4;
+                        }
+                    }
+                }
+            }
+
+            // Where the centers of size full-size pixels fall on a grid
+            // `scale` times coarser: the lower of the two coarse indices
+            // around each, clamped to the grid, and the weight of the upper.
+            void locate(unsigned size, unsigned coarse_size, double scale, unsigned *lower, float *weight)
+            {
+                for (auto i{0u}; i < size; i++)
+                {
+                    auto u{std::clamp((i + 0.5) / scale - 0.5, 0.0, coarse_size - 1.0)};
+
+                    lower[i] = static_cast<unsigned>(u);
+                    weight[i] = u - lower[i];
+                }
+            }
+
+            // Rows [y_begin, y_end) of dst interpolated from the coarse
+            // image, with the column positions followed by the row positions
+            // in lower and weight.
+            void expand(const Matrix &coarse, Matrix &dst, unsigned const *lower, float const *weight, unsigned y_begin, unsigned y_end)
+            {
+                auto x_size{dst.get_x_size()};
+                auto coarse_x{coarse.get_x_size()}, coarse_y{coarse.get_y_size()};
+                auto stride{coarse.get_stride()};
+
+                unsigned char const *in[3]{coarse.get_R(), coarse.get_G(), coarse.get_B()};
+                unsigned char *out[3]{dst.get_R(), dst.get_G(), dst.get_B()};
+
+                for (auto c{0}; c < 3; c++)
+                {
+                    for (auto y{y_begin}; y < y_end; y++)
+                    {
+                        auto top{in[c] + lower[x_size + y] * stride};
+                        auto bottom{in[c] + std::min(lower[x_size + y] + 1, coarse_y - 1) * stride};
+                        auto wy{weight[x_size + y]};
+                        auto row{out[c] + y * dst.get_stride()};
+
+                        for (auto x{0u}; x < x_size; x++)
+                        {
+                            auto a{lower[x]}, b{std::min(a + 1, coarse_x - 1)};
+                            auto wx{weight[x]};
+                            auto upper{top[a] + wx * (top[b] - top[a])};
+                            auto under{bottom[a] + wx * (bottom[b] - bottom[a])};
+
+                            row[x] = upper + wy * (under - upper) + 0.5f;
+                        }
+                    }
+                }
+            }
+        }
+
+        int levels(int radius)
+        {
+            auto count{0};
+
+            while (coarse_radius(radius, count + 1) >= min_radius)
+            {
+                count++;
+            }
+
+            return count;
+        }
+
+        void blur(const Matrix &m, Matrix &dst, const int radius, const unsigned threads, Workspace &workspace)
+        {
+            auto count{levels(radius)};
+
+            if (count == 0)
+            {
+                threads > 1 ? blur_par(m, dst, radius, threads, Engine::exact, workspace) : Filter::blur(m, dst, radius, Engine::exact, workspace);
+                return;
+            }
+
+            auto &pyramid{workspace.pyramid};
+
+            if (pyramid.size() < static_cast<std::size_t>(count + 1))
+            {
+                pyramid.resize(count + 1);
+            }
+
+            // pyramid[i] is level i + 1; the last slot takes the coarse blur.
+            halve(m, pyramid[0]);
+
+            for (auto i{1}; i < count; i++)
+            {
+                halve(pyramid[i - 1], pyramid[i]);
+            }
+
+            auto &coarse{pyramid[count - 1]};
+            auto &blurred{pyramid[count]};
+            auto coarse_blur_radius{static_cast<int>(std::lround(coarse_radius(radius, count)))};
+
+            threads > 1 ? blur_par(coarse, blurred, coarse_blur_radius, threads, Engine::exact, workspace) : Filter::blur(coarse, blurred, coarse_blur_radius, Engine::exact, workspace);
+
+            auto x_size{m.get_x_size()}, y_size{m.get_y_size()};
+            auto scale{std::ldexp(1.0, count)};
+
+            dst.resize(x_size, y_size, dst.get_layout());
+            dst.set_color_max(m.get_color_max());
+            workspace.lower.resize(x_size + y_size);
+            workspace.weight.resize(x_size + y_size);
+
+            auto lower{workspace.lower.data()};
+            auto weight{workspace.weight.data()};
+
+            locate(x_size, blurred.get_x_size(), scale, lower, weight);
+            locate(y_size, blurred.get_y_size(), scale, lower + x_size, weight + x_size);
+
+            if (threads <= 1)
+            {
+                expand(blurred, dst, lower, weight, 0, y_size);
+                return;
+            }
+
+            std::vector<std::thread> workers{};
+
+            for (auto i{0u}; i < threads; i++)
+            {
+                auto [begin, end]{Parallel::band(i, threads, y_size)};
+                workers.emplace_back([&, i, begin = begin, end = end] {
+                    Parallel::pin(i);
+                    expand(blurred, dst, lower, weight, begin, end);
+                });
+            }
+
+            for (auto &worker : workers)
+            {
+                worker.join();
+            }
+        }
+    }
+
+}
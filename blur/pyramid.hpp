@@ -0,0 +1,50 @@
+/*
+Author: David Holmqvist <daae19@student.bth.se>
+*/
+
+#include "filters.hpp"
+#include "matrix.hpp"
+
+#if !defined(PYRAMID_HPP)
+#define PYRAMID_HPP
+
+namespace Filter
+{
+
+    // Large radii at a fraction of the resolution: the image is halved with
+    // 2x2 averages until the radius would drop below min_radius, blurred
+    // there with the exact engine, and brought back to full size by
+    // bilinear interpolation in one step. The coarse radius is chosen so
+    // that its variance plus the variances the halving and interpolation
+    // add up to the requested kernel's, so the result keeps its width. Work
+    // at full resolution is a fixed few operations per pixel, and the
+    // coarse blur shrinks by a factor of 8 with every level, so the cost no
+    // longer grows with the radius.
+    //
+    // Quality against the exact engine on data/im1.ppm and data/im2.ppm,
+    // the worse of the two, with the time of both at -O2 on im2 (psnr tool):
+    //
+    //   radius    PSNR dB    max    mean    exact s    pyramid s
+    //       40          -      0       0       0.13         0.13    (exact)
+    //       50       54.7      3    0.22       0.19        0.046
+    //      100       53.3      2    0.30       0.41        0.027
+    //      200       51.6      4    0.43       1.03        0.022
+    //      400       50.9      3    0.52       3.74        0.020
+    //     1000       48.2      4    0.68      16.9         0.015
+    //
+    // A min_radius of 12 costs about 5 dB, one of 40 gains about 1 dB for
+    // a coarse blur four times as slow. Radii up to 48 get the exact engine
+    // unchanged.
+    namespace Pyramid
+    {
+        constexpr int min_radius{24};
+
+        // Halvings used for a radius, 0 when the exact engine is used.
+        int levels(int radius);
+
+        void blur(const Matrix &m, Matrix &dst, const int radius, const unsigned threads, Workspace &workspace);
+    }
+
+}
+
+#endif
@@ -0,0 +1,327 @@
+/*
+Author: David Holmqvist <daae19@student.bth.se>
+*/
+
+#include "simd.hpp"
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <immintrin.h>
+
+namespace Filter
+{
+
+    namespace Simd
+    {
+        namespace
+        {
+            // Lanes hold one output pixel each, and every lane goes through
+            // the exact multiply, add and divide sequence of the scalar loop.
+            // That keeps the result bit-identical, but it also means lanes
+            // must stay double: float or fixed-point accumulators would round
+            // differently. To keep the add latency hidden each iteration
+            // runs four independent accumulators, i.e. 8 pixels for SSE4.1,
+            // 16 for AVX2 and 32 for AVX-512.
+            constexpr int accumulators{4};
+
+            void scalar(unsigned char const *in, unsigned char *out, int begin, int end, const double *w, int radius, double n)
+            {
+                for (auto x{begin}; x < end; x++)
+                {
+                    auto v{w[0] * in[x]};
+
+                    for (auto wi{1}; wi <= radius; wi++)
+                    {
+                        v += w[wi] * in[x - wi];
+                        v += w[wi] * in[x + wi];
+                    }
+                    out[x] = v / n;
+                }
+            }
+
+            // The scalar column loop over out[begin..length), also used for
+            // the tails the vector variants leave.
+            void columns_from(unsigned char const *const *rows, const double *w, int taps, unsigned char *out, unsigned begin, unsigned length, double n)
+            {
+                for (auto x{begin}; x < length; x++)
+                {
+                    auto v{w[0] * rows[0][x]};
+
+                    for (auto t{1}; t < taps; t++)
+                    {
+                        v += w[t] * rows[t][x];
+                    }
+                    out[x] = v / n;
+                }
+            }
+
+            void scalar_columns(unsigned char const *const *rows, const double *w, int taps, unsigned char *out, unsigned length, double n)
+            {
+                columns_from(rows, w, taps, out, 0, length, n);
+            }
+
+            __attribute__((target("sse4.1"))) inline __m128d load_sse4(unsigned char const *p)
+            {
+                std::uint16_t bytes{};
+                std::memcpy(&bytes, p, sizeof(bytes));
+                return _mm_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(bytes)));
+            }
+
+            __attribute__((target("sse4.1"))) void sse4(unsigned char const *in, unsigned char *out, int begin, int end, const double *w, int radius, double n)
+            {
+                constexpr int lanes{2}, step{lanes * accumulators};
+                auto vn{_mm_set1_pd(n)};
+                auto x{begin};
+
+                for (; x + step <= end; x += step)
+                {
+                    auto w0{_mm_set1_pd(w[0])};
+                    __m128d v[accumulators];
+
+                    for (auto a{0}; a < accumulators; a++)
+                    {
+                        v[a] = _mm_mul_pd(w0, load_sse4(in + x + a * lanes));
+                    }
+
+                    for (auto wi{1}; wi <= radius; wi++)
+                    {
+                        auto wc{_mm_set1_pd(w[wi])};
+
+                        for (auto a{0}; a < accumulators; a++)
+                        {
+                            v[a] = _mm_add_pd(v[a], _mm_mul_pd(wc, load_sse4(in + x + a * lanes - wi)));
+                            v[a] = _mm_add_pd(v[a], _mm_mul_pd(wc, load_sse4(in + x + a * lanes + wi)));
+                        }
+                    }
+
+                    for (auto a{0}; a < accumulators; a++)
+                    {
+                        auto q{_mm_cvttpd_epi32(_mm_div_pd(v[a], vn))};
+                        q = _mm_packus_epi16(_mm_packus_epi32(q, q), q);
+                        auto bytes{static_cast<std::uint16_t>(_mm_cvtsi128_si32(q))};
+                        std::memcpy(out + x + a * lanes, &bytes, sizeof(bytes));
+                    }
+                }
+
+                scalar(in, out, x, end, w, radius, n);
+            }
+
+            __attribute__((target("sse4.1"))) void sse4_columns(unsigned char const *const *rows, const double *w, int taps, unsigned char *out, unsigned length, double n)
+            {
+                constexpr unsigned lanes{2};
+                auto vn{_mm_set1_pd(n)};
+                auto x{0u};
+
+                for (; x + lanes <= length; x += lanes)
+                {
+                    auto v{_mm_mul_pd(_mm_set1_pd(w[0]), load_sse4(rows[0] + x))};
+
+                    for (auto t{1}; t < taps; t++)
+                    {
+                        v = _mm_add_pd(v, _mm_mul_pd(_mm_set1_pd(w[t]), load_sse4(rows[t] + x)));
+                    }
+
+                    auto q{_mm_cvttpd_epi32(_mm_div_pd(v, vn))};
+                    q = _mm_packus_epi16(_mm_packus_epi32(q, q), q);
+                    auto bytes{static_cast<std::uint16_t>(_mm_cvtsi128_si32(q))};
+                    std::memcpy(out + x, &bytes, sizeof(bytes));
+                }
+
+                columns_from(rows, w, taps, out, x, length, n);
+            }
+
+            __attribute__((target("avx2"))) inline __m256d load_avx2(unsigned char const *p)
+            {
+                std::uint32_t bytes{};
+                std::memcpy(&bytes, p, sizeof(bytes));
+                return _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(bytes)));
+            }
+
+            __attribute__((target("avx2"))) void avx2(unsigned char const *in, unsigned char *out, int begin, int end, const double *w, int radius, double n)
+            {
+                constexpr int lanes{4}, step{lanes * accumulators};
+                auto vn{_mm256_set1_pd(n)};
+                auto x{begin};
+
+                for (; x + step <= end; x += step)
+                {
+                    auto w0{_mm256_set1_pd(w[0])};
+                    __m256d v[accumulators];
+
+                    for (auto a{0}; a < accumulators; a++)
+                    {
+                        v[a] = _mm256_mul_pd(w0, load_avx2(in + x + a * lanes));
+                    }
+
+                    for (auto wi{1}; wi <= radius; wi++)
+                    {
+                        auto wc{_mm256_set1_pd(w[wi])};
+
+                        for (auto a{0}; a < accumulators; a++)
+                        {
+                            v[a] = _mm256_add_pd(v[a], _mm256_mul_pd(wc, load_avx2(in + x + a * lanes - wi)));
+                            v[a] = _mm256_add_pd(v[a], _mm256_mul_pd(wc, load_avx2(in + x + a * lanes + wi)));
+                        }
+                    }
+
+                    for (auto a{0}; a < accumulators; a++)
+                    {
+                        auto q{_mm256_cvttpd_epi32(_mm256_div_pd(v[a], vn))};
+                        q = _mm_packus_epi16(_mm_packus_epi32(q, q), q);
+                        auto bytes{static_cast<std::uint32_t>(_mm_cvtsi128_si32(q))};
+                        std::memcpy(out + x + a * lanes, &bytes, sizeof(bytes));
+                    }
+                }
+
+                scalar(in, out, x, end, w, radius, n);
+            }
+
+            __attribute__((target("avx2"))) void avx2_columns(unsigned char const *const *rows, const double *w, int taps, unsigned char *out, unsigned length, double n)
+            {
+                constexpr unsigned lanes{4};
+                auto vn{_mm256_set1_pd(n)};
+                auto x{0u};
+
+                for (; x + lanes <= length; x += lanes)
+                {
+                    auto v{_mm256_mul_pd(_mm256_set1_pd(w[0]), load_avx2(rows[0] + x))};
+
+                    for (auto t{1}; t < taps; t++)
+                    {
+                        v = _mm256_add_pd(v, _mm256_mul_pd(_mm256_set1_pd(w[t]), load_avx2(rows[t] + x)));
+                    }
+
+                    auto q{_mm256_cvttpd_epi32(_mm256_div_pd(v, vn))};
+                    q = _mm_packus_epi16(_mm_packus_epi32(q, q), q);
+                    auto bytes{static_cast<std::uint32_t>(_mm_cvtsi128_si32(q))};
+                    std::memcpy(out + x, &bytes, sizeof(bytes));
+                }
+
+                columns_from(rows, w, taps, out, x, length, n);
+            }
+
+            __attribute__((target("avx512f,avx512vl"))) inline __m512d load_avx512(unsigned char const *p)
+            {
+                return _mm512_cvtepi32_pd(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<__m128i const *>(p))));
+            }
+
+            __attribute__((target("avx512f,avx512vl"))) void avx512(unsigned char const *in, unsigned char *out, int begin, int end, const double *w, int radius, double n)
+            {
+                constexpr int lanes{8}, step{lanes * accumulators};
+                auto vn{_mm512_set1_pd(n)};
+                auto x{begin};
+
+                for (; x + step <= end; x += step)
+                {
+                    auto w0{_mm512_set1_pd(w[0])};
+                    __m512d v[accumulators];
+
+                    for (auto a{0}; a < accumulators; a++)
+                    {
+                        v[a] = _mm512_mul_pd(w0, load_avx512(in + x + a * lanes));
+                    }
+
+                    for (auto wi{1}; wi <= radius; wi++)
+                    {
+                        auto wc{_mm512_set1_pd(w[wi])};
+
+                        for (auto a{0}; a < accumulators; a++)
+                        {
+                            v[a] = _mm512_add_pd(v[a], _mm512_mul_pd(wc, load_avx512(in + x + a * lanes - wi)));
+                            v[a] = _mm512_add_pd(v[a], _mm512_mul_pd(wc, load_avx512(in + x + a * lanes + wi)));
+                        }
+                    }
+
+                    for (auto a{0}; a < accumulators; a++)
+                    {
+                        auto q{_mm512_cvttpd_epi32(_mm512_div_pd(v[a], vn))};
+                        _mm_storel_epi64(reinterpret_cast<__m128i *>(out + x + a * lanes), _mm256_cvtepi32_epi8(q));
+                    }
+                }
+
+                scalar(in, out, x, end, w, radius, n);
+            }
+
+            __attribute__((target("avx512f,avx512vl"))) void avx512_columns(unsigned char const *const *rows, const double *w, int taps, unsigned char *out, unsigned length, double n)
+            {
+                constexpr unsigned lanes{8};
+                auto vn{_mm512_set1_pd(n)};
+                auto x{0u};
+
+                for (; x + lanes <= length; x += lanes)
+                {
+                    auto v{_mm512_mul_pd(_mm512_set1_pd(w[0]), load_avx512(rows[0] + x))};
+
+                    for (auto t{1}; t < taps; t++)
+                    {
+                        v = _mm512_add_pd(v, _mm512_mul_pd(_mm512_set1_pd(w[t]), load_avx512(rows[t] + x)));
+                    }
+
+                    auto q{_mm512_cvttpd_epi32(_mm512_div_pd(v, vn))};
+                    _mm_storel_epi64(reinterpret_cast<__m128i *>(out + x), _mm256_cvtepi32_epi8(q));
+                }
+
+                columns_from(rows, w, taps, out, x, length, n);
+            }
+
+            struct Variant
+            {
+                const char *name;
+                RowKernel kernel;
+                ColumnKernel columns;
+                bool supported;
+            };
+
+            const Variant &select()
+            {
+                __builtin_cpu_init();
+
+                // Widest first; the first supported one at or below the
+                // BLUR_ISA cap wins.
+                static const Variant variants[]{
+                    {"avx512", avx512, avx512_columns, __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl")},
+                    {"avx2", avx2, avx2_columns, __builtin_cpu_supports("avx2") != 0},
+                    {"sse4", sse4, sse4_columns, __builtin_cpu_supports("sse4.1") != 0},
+                    {"scalar", scalar, scalar_columns, true},
+                };
+
+                auto cap{std::getenv("BLUR_ISA")};
+                auto capped{cap == nullptr};
+
+                for (auto &variant : variants)
+                {
+                    capped = capped || std::strcmp(cap, variant.name) == 0;
+
+                    if (capped && variant.supported)
+                    {
+                        return variant;
+                    }
+                }
+
+                return variants[3];
+            }
+
+            const Variant &selected()
+            {
+                static const Variant &variant{select()};
+                return variant;
+            }
+        }
+
+        RowKernel row_kernel()
+        {
+            return selected().kernel;
+        }
+
+        ColumnKernel column_kernel()
+        {
+            return selected().columns;
+        }
+
+        const char *row_kernel_name()
+        {
+            return selected().name;
+        }
+    }
+
+}
@@ -0,0 +1,37 @@
+/*
+Author: David Holmqvist <daae19@student.bth.se>
+*/
+
+#if !defined(SIMD_HPP)
+#define SIMD_HPP
+
+namespace Filter
+{
+
+    namespace Simd
+    {
+        // Computes the interior outputs out[begin..end) of one row as
+        //   (w[0] * in[x] + w[1] * in[x - 1] + w[1] * in[x + 1] + ...) / n
+        // with the same double operations, in the same order, as the scalar
+        // loop, so every variant produces identical bytes.
+        using RowKernel = void (*)(unsigned char const *in, unsigned char *out, int begin, int end, const double *w, int radius, double n);
+
+        // Computes out[0..length) as
+        //   (w[0] * rows[0][x] + w[1] * rows[1][x] + ... + w[taps - 1] * rows[taps - 1][x]) / n
+        // adding the taps left to right, which is how the vertical pass of
+        // the exact engine combines whole rows without transposing.
+        using ColumnKernel = void (*)(unsigned char const *const *rows, const double *w, int taps, unsigned char *out, unsigned length, double n);
+
+        // The widest variant the CPU supports, picked once from CPUID on
+        // first use. Setting BLUR_ISA to scalar, sse4, avx2 or avx512 caps
+        // the choice, which is how the narrower paths get tested on wide
+        // hosts.
+        RowKernel row_kernel();
+        ColumnKernel column_kernel();
+
+        const char *row_kernel_name();
+    }
+
+}
+
+#endif
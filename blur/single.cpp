@@ -0,0 +1,253 @@
+/*
+Author: David Holmqvist <daae19@student.bth.se>
+*/
+
+#include "single.hpp"
+#include "simd.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <immintrin.h>
+#include <vector>
+
+namespace Filter
+{
+
+    namespace Single
+    {
+        namespace
+        {
+            // As in the double kernels, four independent accumulators keep
+            // the multiply-add latency hidden.
+            constexpr int accumulators{4};
+
+            // The scalar loops are inlined into every variant. std::fma is a
+            // library call in the plain one and a single instruction in the
+            // others; either way it rounds once, so the results agree.
+
+            // Pixels [begin, end) of the interior, where every tap is inside
+            // the row and w sums to one.
+            __attribute__((always_inline)) inline void interior(unsigned char const *in, unsigned char *out, int begin, int end, const float *w, int radius)
+            {
+                for (auto x{begin}; x < end; x++)
+                {
+                    auto v{w[0] * in[x]};
+
+                    for (auto wi{1}; wi <= radius; wi++)
+                    {
+                        v = std::fma(w[wi], static_cast<float>(in[x - wi]), v);
+                        v = std::fma(w[wi], static_cast<float>(in[x + wi]), v);
+                    }
+                    out[x] = std::min(v, 255.0f);
+                }
+            }
+
+            // Pixels [begin, end) near an edge: the interior weights over
+            // the taps inside the row, scaled back up to sum to one. The tap
+            // loop is split where the nearer side runs out, as in blur_span().
+            __attribute__((always_inline)) inline void edges(unsigned char const *in, unsigned char *out, int size, const float *w, const Gauss::Kernel &kernel, int begin, int end)
+            {
+                auto radius{kernel.get_radius()};
+
+                for (auto x{begin}; x < end; x++)
+                {
+                    auto left{std::min(x, radius)}, right{std::min(size - 1 - x, radius)};
+                    auto both{std::min(left, right)};
+                    auto v{w[0] * in[x]};
+
+                    for (auto wi{1}; wi <= both; wi++)
+                    {
+                        v = std::fma(w[wi], static_cast<float>(in[x - wi]), v);
+                        v = std::fma(w[wi], static_cast<float>(in[x + wi]), v);
+                    }
+                    for (auto wi{both + 1}; wi <= left; wi++)
+                    {
+                        v = std::fma(w[wi], static_cast<float>(in[x - wi]), v);
+                    }
+                    for (auto wi{both + 1}; wi <= right; wi++)
+                    {
+                        v = std::fma(w[wi], static_cast<float>(in[x + wi]), v);
+                    }
+
+                    auto scale{static_cast<float>(kernel.sum(radius, radius) / kernel.sum(x, size - 1 - x))};
+                    out[x] = std::min(v * scale, 255.0f);
+                }
+            }
+
+            // The interior of a row, [begin, end).
+            struct Bounds
+            {
+                int begin;
+                int end;
+            };
+
+            Bounds bounds(int size, int radius)
+            {
+                auto begin{std::min(radius, size)};
+                return {begin, std::max(size - radius, begin)};
+            }
+
+            // Each variant blurs one whole row: the edges and whatever the
+            // vector loop leaves with the scalar loops, the rest with vectors.
+            void row_scalar(unsigned char const *in, unsigned char *out, int size, const float *w, const Gauss::Kernel &kernel)
+            {
+                auto [begin, end]{bounds(size, kernel.get_radius())};
+
+                edges(in, out, size, w, kernel, 0, begin);
+                interior(in, out, begin, end, w, kernel.get_radius());
+                edges(in, out, size, w, kernel, end, size);
+            }
+
+            __attribute__((target("fma"))) void row_fma(unsigned char const *in, unsigned char *out, int size, const float *w, const Gauss::Kernel &kernel)
+            {
+                auto [begin, end]{bounds(size, kernel.get_radius())};
+
+                edges(in, out, size, w, kernel, 0, begin);
+                interior(in, out, begin, end, w, kernel.get_radius());
+                edges(in, out, size, w, kernel, end, size);
+            }
+
+            __attribute__((target("avx2,fma"))) inline __m256 load_avx2(unsigned char const *p)
+            {
+                return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<__m128i const *>(p))));
+            }
+
+            __attribute__((target("avx2,fma"))) void row_avx2(unsigned char const *in, unsigned char *out, int size, const float *w, const Gauss::Kernel &kernel)
+            {
+                constexpr int lanes{8}, step{lanes * accumulators};
+                auto radius{kernel.get_radius()};
+                auto [begin, end]{bounds(size, radius)};
+                auto x{begin};
+
+                edges(in, out, size, w, kernel, 0, begin);
+
+                for (; x + step <= end; x += step)
+                {
+                    auto w0{_mm256_set1_ps(w[0])};
+                    __m256 v[accumulators];
+
+                    for (auto a{0}; a < accumulators; a++)
+                    {
+                        v[a] = _mm256_mul_ps(w0, load_avx2(in + x + a * lanes));
+                    }
+
+                    for (auto wi{1}; wi <= radius; wi++)
+                    {
+                        auto wc{_mm256_set1_ps(w[wi])};
+
+                        for (auto a{0}; a < accumulators; a++)
+                        {
+                            v[a] = _mm256_fmadd_ps(wc, load_avx2(in + x + a * lanes - wi), v[a]);
+                            v[a] = _mm256_fmadd_ps(wc, load_avx2(in + x + a * lanes + wi), v[a]);
+                        }
+                    }
+
+                    // Truncate, then saturate on the way down to bytes.
+                    for (auto a{0}; a < accumulators; a++)
+                    {
+                        auto q{_mm256_cvttps_epi32(v[a])};
+                        auto words{_mm_packus_epi32(_mm256_castsi256_si128(q), _mm256_extracti128_si256(q, 1))};
+                        _mm_storel_epi64(reinterpret_cast<__m128i *>(out + x + a * lanes), _mm_packus_epi16(words, words));
+                    }
+                }
+
+                // The scalar loops may call into libm, whose SSE code stalls
+                // on dirty upper vector halves in builds that leave out the
+                // compiler's own vzeroupper.
+                _mm256_zeroupper();
+                interior(in, out, x, end, w, radius);
+                edges(in, out, size, w, kernel, end, size);
+            }
+
+            __attribute__((target("avx512f,avx512vl,fma"))) inline __m512 load_avx512(unsigned char const *p)
+            {
+                return _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<__m128i const *>(p))));
+            }
+
+            __attribute__((target("avx512f,avx512vl,fma"))) void row_avx512(unsigned char const *in, unsigned char *out, int size, const float *w, const Gauss::Kernel &kernel)
+            {
+                constexpr int lanes{16}, step{lanes * accumulators};
+                auto radius{kernel.get_radius()};
+                auto [begin, end]{bounds(size, radius)};
+                auto x{begin};
+
+                edges(in, out, size, w, kernel, 0, begin);
+
+                for (; x + step <= end; x += step)
+                {
+                    auto w0{_mm512_set1_ps(w[0])};
+                    __m512 v[accumulators];
+
+                    for (auto a{0}; a < accumulators; a++)
+                    {
+                        v[a] = _mm512_mul_ps(w0, load_avx512(in + x + a * lanes));
+                    }
+
+                    for (auto wi{1}; wi <= radius; wi++)
+                    {
+                        auto wc{_mm512_set1_ps(w[wi])};
+
+                        for (auto a{0}; a < accumulators; a++)
+                        {
+                            v[a] = _mm512_fmadd_ps(wc, load_avx512(in + x + a * lanes - wi), v[a]);
+                            v[a] = _mm512_fmadd_ps(wc, load_avx512(in + x + a * lanes + wi), v[a]);
+                        }
+                    }
+
+                    for (auto a{0}; a < accumulators; a++)
+                    {
+                        auto q{_mm512_cvttps_epi32(_mm512_min_ps(v[a], _mm512_set1_ps(255.0f)))};
+                        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + x + a * lanes), _mm512_cvtepi32_epi8(q));
+                    }
+                }
+
+                // See row_avx2().
+                _mm256_zeroupper();
+                interior(in, out, x, end, w, radius);
+                edges(in, out, size, w, kernel, end, size);
+            }
+
+            using Row = void (*)(unsigned char const *in, unsigned char *out, int size, const float *w, const Gauss::Kernel &kernel);
+
+            // Follows the ISA chosen for the exact engine, BLUR_ISA cap
+            // included, as long as the CPU has FMA.
+            Row row()
+            {
+                static const Row selected{[] {
+                    auto name{Simd::row_kernel_name()};
+
+                    if (!__builtin_cpu_supports("fma") || std::strcmp(name, "scalar") == 0)
+                    {
+                        return row_scalar;
+                    }
+                    if (std::strcmp(name, "avx512") == 0)
+                    {
+                        return row_avx512;
+                    }
+                    if (std::strcmp(name, "avx2") == 0)
+                    {
+                        return row_avx2;
+                    }
+                    return row_fma;
+                }()};
+
+                return selected;
+            }
+        }
+
+        void blur_rows(unsigned char const *src, std::size_t src_stride, unsigned char *dst, std::size_t dst_stride, unsigned length, const Gauss::Kernel &kernel, unsigned y_begin, unsigned y_end)
+        {
+            auto radius{kernel.get_radius()};
+            auto blur_row{row()};
+
+            thread_local std::vector<float> w{};
+            w.assign(kernel.get_normalized(), kernel.get_normalized() + radius + 1);
+
+            for (auto y{y_begin}; y < y_end; y++)
+            {
+                blur_row(src + y * src_stride, dst + y * dst_stride, length, w.data(), kernel);
+            }
+        }
+    }
+
+}
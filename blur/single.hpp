@@ -0,0 +1,41 @@
+/*
+Author: David Holmqvist <daae19@student.bth.se>
+*/
+
+#include "filters.hpp"
+
+#if !defined(SINGLE_HPP)
+#define SINGLE_HPP
+
+namespace Filter
+{
+
+    // The Gauss kernel in single precision: weights prenormalized to float,
+    // accumulated with fused multiply-adds and truncated on store like the
+    // exact engine. Vectors hold twice the pixels of the double engine's,
+    // and the multiply and add of a tap are one instruction. Every variant,
+    // scalar included, does the same fused operations in the same order, so
+    // they all produce the same bytes.
+    //
+    // Error against the exact engine, see Filter::Engine:
+    //
+    //   radius    max    mean
+    //        3      2    0.033
+    //       15      1    0.012
+    //       40      1    0.0004
+    //      100      1    0.0001
+    //      300      1    0.0001
+    //
+    // Differences are pixels whose sum lands within float rounding of a
+    // level boundary.
+    namespace Single
+    {
+        // Blurs the rows [y_begin, y_end) of a plane of `length` pixel rows
+        // into dst with the weights of `kernel`; rows lie src_stride and
+        // dst_stride pixels apart.
+        void blur_rows(unsigned char const *src, std::size_t src_stride, unsigned char *dst, std::size_t dst_stride, unsigned length, const Gauss::Kernel &kernel, unsigned y_begin, unsigned y_end);
+    }
+
+}
+
+#endif
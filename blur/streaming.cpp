@@ -0,0 +1,91 @@
+/*
+Author: David Holmqvist <daae19@student.bth.se>
+*/
+
+#include "streaming.hpp"
+#include "filters.hpp"
+#include "simd.hpp"
+#include <algorithm>
+#include <vector>
+
+namespace Filter
+{
+
+    bool blur_streaming(PPM::RowReader &reader, PPM::RowWriter &writer, const int radius)
+    {
+        auto &kernel{Gauss::Kernel::get(radius)};
+        auto w{kernel.get_weights()};
+        auto columns{Simd::column_kernel()};
+
+        auto x_size{reader.get_x_size()};
+        auto y_size{static_cast<int>(reader.get_y_size())};
+        auto ring_size{std::min(2 * radius + 1, y_size)};
+
+        std::vector<unsigned char> in(3 * x_size), out(3 * x_size), ring(3 * static_cast<std::size_t>(ring_size) * x_size);
+        std::vector<unsigned char const *> rows(2 * radius + 1);
+        std::vector<double> weights(2 * radius + 1);
+
+        // Plane c of horizontally blurred row y.
+        auto slot{[&](int y, int c) {
+            return ring.data() + (static_cast<std::size_t>(c) * ring_size + y % ring_size) * x_size;
+        }};
+
+        // The vertical pass for row y, with the taps listed in the order the
+        // transposed pass adds them so the sums round identically.
+        auto emit{[&](int y) {
+            for (auto c{0}; c < 3; c++)
+            {
+                auto taps{0};
+                rows[taps] = slot(y, c);
+                weights[taps++] = w[0];
+
+                for (auto wi{1}; wi <= radius; wi++)
+                {
+                    if (y - wi >= 0)
+                    {
+                        rows[taps] = slot(y - wi, c);
+                        weights[taps++] = w[wi];
+                    }
+                    if (y + wi < y_size)
+                    {
+                        rows[taps] = slot(y + wi, c);
+                        weights[taps++] = w[wi];
+                    }
+                }
+
+                columns(rows.data(), weights.data(), taps, out.data() + c * x_size, x_size, kernel.sum(y, y_size - 1 - y));
+            }
+
+            writer.write_row(out.data(), out.data() + x_size, out.data() + 2 * x_size, x_size);
+        }};
+
+        auto next{0};
+
+        for (auto y{0}; y < y_size; y++)
+        {
+            if (!reader.read_row(in.data(), in.data() + x_size, in.data() + 2 * x_size))
+            {
+                return false;
+            }
+
+            for (auto c{0}; c < 3; c++)
+            {
+                blur_rows(in.data() + c * x_size, x_size, slot(y, c), x_size, x_size, kernel, 0, 1);
+            }
+
+            // Row `next` is complete once the row radius below it is in.
+            for (; next + radius <= y; next++)
+            {
+                emit(next);
+            }
+        }
+
+        for (; next < y_size; next++)
+        {
+            emit(next);
+        }
+
+        return true;
+    }
+
+}
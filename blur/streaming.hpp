@@ -0,0 +1,23 @@
+/*
+Author: David Holmqvist <daae19@student.bth.se>
+*/
+
+#include "ppm.hpp"
+
+#if !defined(STREAMING_HPP)
+#define STREAMING_HPP
+
+namespace Filter
+{
+
+    // Blurs the image behind `reader` with the exact engine while it is
+    // being read, for images beyond PPM::max_pixels. Every row gets its
+    // horizontal pass as it arrives; a ring of the last 2 * radius + 1
+    // horizontally blurred rows feeds the vertical pass, and each finished
+    // row goes to `writer` straight away. Memory is O(width * radius)
+    // whatever the height, and the output is byte-identical to blur().
+    bool blur_streaming(PPM::RowReader &reader, PPM::RowWriter &writer, const int radius);
+
+}
+
+#endif
@@ -0,0 +1,158 @@
+/*
+Author: David Holmqvist <daae19@student.bth.se>
+*/
+
+#include "tiled.hpp"
+#include "parallel.hpp"
+#include "simd.hpp"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace Filter
+{
+
+    namespace Tiled
+    {
+        namespace
+        {
+            // Tile widths are whole cache lines, unless the image is
+            // narrower.
+            constexpr unsigned line{64};
+            constexpr unsigned min_height{32};
+
+            // Blurs tile `index` into dst, using `buffer` for its
+            // horizontally blurred rows and `taps`/`weights` (2 * radius + 1
+            // each) for the vertical pass.
+            void blur_tile(const Matrix &m, Matrix &dst, const Gauss::Kernel &kernel, const Tiling &tiling, unsigned index,
+                           unsigned char *buffer, unsigned char const **taps, double *weights)
+            {
+                auto radius{kernel.get_radius()};
+                auto w{kernel.get_weights()};
+                auto columns{Simd::column_kernel()};
+
+                auto x_size{m.get_x_size()};
+                auto y_size{static_cast<int>(m.get_y_size())};
+                auto x_begin{index % tiling.columns * tiling.width};
+                auto x_end{std::min(x_begin + tiling.width, x_size)};
+                auto width{x_end - x_begin};
+                auto y_begin{static_cast<int>(index / tiling.columns * tiling.height)};
+                auto y_end{std::min(y_begin + static_cast<int>(tiling.height), y_size)};
+                auto top{std::max(y_begin - radius, 0)};
+                auto bottom{std::min(y_end + radius, y_size)};
+
+                unsigned char const *src[3]{m.get_R(), m.get_G(), m.get_B()};
+                unsigned char *out[3]{dst.get_R(), dst.get_G(), dst.get_B()};
+
+                for (auto c{0}; c < 3; c++)
+                {
+                    for (auto y{top}; y < bottom; y++)
+                    {
+                        blur_span(src[c] + y * m.get_stride(), buffer + static_cast<std::size_t>(y - top) * width, x_size, kernel, x_begin, x_end);
+                    }
+
+                    auto row{[&](int y) {
+                        return buffer + static_cast<std::size_t>(y - top) * width;
+                    }};
+
+                    // The taps in the order the transposed pass adds them,
+                    // as in blur_streaming().
+                    for (auto y{y_begin}; y < y_end; y++)
+                    {
+                        auto count{0};
+                        taps[count] = row(y);
+                        weights[count++] = w[0];
+
+                        for (auto wi{1}; wi <= radius; wi++)
+                        {
+                            if (y - wi >= 0)
+                            {
+                                taps[count] = row(y - wi);
+                                weights[count++] = w[wi];
+                            }
+                            if (y + wi < y_size)
+                            {
+                                taps[count] = row(y + wi);
+                                weights[count++] = w[wi];
+                            }
+                        }
+
+                        columns(taps, weights, count, out[c] + y * dst.get_stride() + x_begin, width, kernel.sum(y, y_size - 1 - y));
+                    }
+                }
+            }
+        }
+
+        Tiling::Tiling(unsigned x_size, unsigned y_size, int radius)
+        {
+            auto halo{2 * static_cast<unsigned>(radius)};
+            auto wanted{std::max(min_height, 4 * halo)};
+
+            width = std::max(tile_bytes / (wanted + halo) / line * line, line);
+            width = std::min(width, x_size);
+            height = std::max(tile_bytes / width, wanted + halo) - halo;
+            height = std::min(height, y_size);
+            columns = (x_size + width - 1) / width;
+            rows = (y_size + height - 1) / height;
+        }
+
+        unsigned Tiling::count() const
+        {
+            return columns * rows;
+        }
+
+        void blur(const Matrix &m, Matrix &dst, const int radius, const unsigned threads, Workspace &workspace)
+        {
+            auto &kernel{Gauss::Kernel::get(radius)};
+            Tiling tiling{m.get_x_size(), m.get_y_size(), radius};
+
+            dst.resize(m.get_x_size(), m.get_y_size(), dst.get_layout());
+            dst.set_color_max(m.get_color_max());
+
+            auto workers{std::min(threads, tiling.count())};
+            std::size_t buffer_size{static_cast<std::size_t>(tiling.height + 2 * radius) * tiling.width};
+            std::size_t taps_size{2 * static_cast<std::size_t>(radius) + 1};
+
+            // Only grows, so a warmed-up workspace is reused as is.
+            workspace.tiles.resize(std::max(workspace.tiles.size(), workers * buffer_size));
+            workspace.taps.resize(std::max(workspace.taps.size(), workers * taps_size));
+            workspace.weights.resize(std::max(workspace.weights.size(), workers * taps_size));
+
+            std::atomic<unsigned> next{0};
+
+            auto work{[&](unsigned i) {
+                auto buffer{workspace.tiles.data() + i * buffer_size};
+                auto taps{workspace.taps.data() + i * taps_size};
+                auto weights{workspace.weights.data() + i * taps_size};
+
+                for (auto index{next++}; index < tiling.count(); index = next++)
+                {
+                    blur_tile(m, dst, kernel, tiling, index, buffer, taps, weights);
+                }
+            }};
+
+            if (workers <= 1)
+            {
+                work(0);
+                return;
+            }
+
+            std::vector<std::thread> pool{};
+
+            for (auto i{0u}; i < workers; i++)
+            {
+                pool.emplace_back([&, i] {
+                    Parallel::pin(i);
+                    work(i);
+                });
+            }
+
+            for (auto &worker : pool)
+            {
+                worker.join();
+            }
+        }
+    }
+
+}
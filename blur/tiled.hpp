@@ -0,0 +1,54 @@
+/*
+Author: David Holmqvist <daae19@student.bth.se>
+*/
+
+#include "filters.hpp"
+#include "matrix.hpp"
+
+#if !defined(TILED_HPP)
+#define TILED_HPP
+
+namespace Filter
+{
+
+    namespace Tiled
+    {
+        // Bytes of horizontally blurred rows, halo included, a tile aims
+        // to keep: well inside a per-core L2, with room left for the source
+        // rows streaming through it. Only a target: once a large radius
+        // has narrowed the tiles to one cache line, their height still
+        // grows with the radius, and so do their bytes.
+        constexpr unsigned tile_bytes{256 * 1024};
+
+        // How an x_size by y_size image is cut into tiles for a radius.
+        // Small radii give full-width bands; large ones narrow the tiles so
+        // that each still holds at least four times as many output rows as
+        // its 2 * radius halo rows, keeping the redone horizontal work at
+        // most a quarter. Tiles are never narrower than a cache line, so
+        // at r = 1000 a tile holds 8000 + 2000 rows of 64 bytes, about
+        // 640 KB a plane, well past tile_bytes.
+        class Tiling
+        {
+        public:
+            unsigned width;
+            unsigned height;
+            unsigned columns;
+            unsigned rows;
+
+            Tiling(unsigned x_size, unsigned y_size, int radius);
+
+            unsigned count() const;
+        };
+
+        // The exact engine with both passes fused per tile: a tile's rows
+        // and their radius-row halo get the horizontal pass into a tile
+        // buffer, and the vertical pass reads them back from there while
+        // they are still in L2, instead of making a full-image scratch
+        // round trip through memory. Tiles are handed out to `threads`
+        // workers one at a time. Byte-identical to the exact engine.
+        void blur(const Matrix &m, Matrix &dst, const int radius, const unsigned threads, Workspace &workspace);
+    }
+
+}
+
+#endif
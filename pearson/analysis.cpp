@@ -7,6 +7,7 @@ Author: David Holmqvist <daae19@student.bth.se>
 #include <cmath>
 #include <iostream>
 #include <list>
+#include <thread>
 #include <vector>
 
 namespace Analysis {
@@ -25,6 +26,51 @@ std::vector<double> correlation_coefficients(std::vector<Vector> datasets)
     return result;
 }
 
+// The pairs (sample1, sample2) with sample1 < sample2 form an upper
+// triangle, row sample1 holding n - 1 - sample1 of them, so splitting by
+// sample1 would hand the first thread most of the work. Every pair costs
+// the same, so instead the pairs are numbered in the serial order and each
+// thread takes an equal run of those numbers, writing to the same slots of
+// result as the serial loop.
+std::vector<double> correlation_coefficients_par(std::vector<Vector> datasets, unsigned threads)
+{
+    std::size_t n { datasets.size() };
+    std::size_t pairs { n < 2 ? 0 : n * (n - 1) / 2 };
+    std::vector<double> result(pairs);
+    std::vector<std::thread> workers {};
+
+    for (auto t { 0u }; t < threads; t++) {
+        auto begin { pairs * t / threads }, end { pairs * (t + 1) / threads };
+
+        workers.emplace_back([&datasets, &result, n, begin, end] {
+            // Row and column of pair number begin.
+            std::size_t sample1 { 0 }, row_begin { 0 };
+
+            while (row_begin + (n - 1 - sample1) <= begin) {
+                row_begin += n - 1 - sample1;
+                sample1++;
+            }
+
+            auto sample2 { sample1 + 1 + (begin - row_begin) };
+
+            for (auto pair { begin }; pair < end; pair++) {
+                result[pair] = pearson(datasets[sample1], datasets[sample2]);
+
+                if (++sample2 == n) {
+                    sample1++;
+                    sample2 = sample1 + 1;
+                }
+            }
+        });
+    }
+
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    return result;
+}
+
 double pearson(Vector vec1, Vector vec2)
 {
     auto x_mean { vec1.mean() };
@@ -10,6 +10,10 @@ Author: David Holmqvist <daae19@student.bth.se>
 
 namespace Analysis {
 std::vector<double> correlation_coefficients(std::vector<Vector> datasets);
+
+// Same coefficients in the same order, with the pairs split over `threads`
+// worker threads.
+std::vector<double> correlation_coefficients_par(std::vector<Vector> datasets, unsigned threads);
 double pearson(Vector vec1, Vector vec2);
 };
 
@@ -0,0 +1,30 @@
+/*
+Author: David Holmqvist <daae19@student.bth.se>
+*/
+
+#include "analysis.hpp"
+#include "dataset.hpp"
+#include <iostream>
+#include <cstdlib>
+#include <string>
+
+int main(int argc, char const* argv[])
+{
+    if (argc != 4) {
+        std::cerr << "Usage: " << argv[0] << " [dataset] [outfile] [threads]" << std::endl;
+        std::exit(1);
+    }
+
+    auto threads { static_cast<unsigned>(std::stoul(argv[3])) };
+
+    if (threads == 0) {
+        std::cerr << "Thread count must be at least 1" << std::endl;
+        std::exit(1);
+    }
+
+    auto datasets { Dataset::read(argv[1]) };
+    auto corrs { Analysis::correlation_coefficients_par(datasets, threads) };
+    Dataset::write(corrs, argv[2]);
+
+    return 0;
+}